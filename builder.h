@@ -6,26 +6,45 @@
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <set>
+#include <map>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #include <cxxabi.h>
+#endif
+
+#ifdef _WIN32
+    #include <process.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "remote.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // prepocessor statements
 ///////////////////////////////////////////////////////////////////////////////
 #ifdef _WIN32
     inline std::string os = "windows";
-    inline std::string compiler = "cl";
-    inline std::string compiler_full_path = "";
 #elif __APPLE__
     inline std::string os = "macos";
-    inline std::string compiler = "clang++";
-    inline std::string compiler_full_path = "";
 #elif __linux__
     inline std::string os = "linux";
-    inline std::string compiler = "g++";
-    inline std::string compiler_full_path = "/usr/bin/g++";
 #else
     inline std::string os = "linux";
-    inline std::string compiler = "g++";
-    inline std::string compiler_full_path = "/usr/bin/g++";
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -58,6 +77,18 @@ enum class Targets {
     MacOS,
 };
 
+enum class DebugInfo {
+    Full,
+    Split,
+    SplitPacked,
+};
+
+enum class DebugCompression {
+    None,
+    Zlib,
+    Zstd,
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // structs
 ///////////////////////////////////////////////////////////////////////////////
@@ -68,451 +99,3633 @@ struct Options {
     std::vector<Debug> debug;
     Optimize optimize;
     Targets target;
+    std::set<Targets> targets;
+    bool gc_sections;
+    bool icf;
+    bool lto;
+    bool reproducible;
+    DebugInfo debug_info;
+    DebugCompression debug_compression;
+};
+
+struct Recipe {
+    std::string name;
+    std::string command;
+    std::vector<std::string> include_dirs;
+    std::vector<std::string> source_dirs;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// functions
+///////////////////////////////////////////////////////////////////////////////
+inline uint64_t hashString(std::string value, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : value) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// runs a shell command and returns what it printed on stdout
+inline std::string readCommand(std::string command) {
+#ifdef _WIN32
+    FILE *pipe = _popen(command.c_str(), "r");
+#else
+    FILE *pipe = popen(command.c_str(), "r");
+#endif
+    if (pipe == nullptr) {
+        return "";
+    }
+
+    std::string output = "";
+    char buffer[4096];
+    size_t n = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        output.append(buffer, n);
+    }
+#ifdef _WIN32
+    _pclose(pipe);
+#else
+    pclose(pipe);
+#endif
+
+    return output;
+}
+
+inline std::string hashToHex(uint64_t hash) {
+    std::ostringstream hex;
+    hex << std::hex;
+    hex.width(16);
+    hex.fill('0');
+    hex << hash;
+
+    return hex.str();
+}
+
+// unique to this process and thread, for temporary files that are renamed
+// into shared caches other builds may be writing at the same time
+inline std::string getTempSuffix() {
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+
+    return std::to_string(pid) + "-" + std::to_string(
+        std::hash<std::thread::id>()(std::this_thread::get_id())
+    );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // classes
 ///////////////////////////////////////////////////////////////////////////////
-class Builder {
+class Jobserver {
     public:
         ///////////////////////////////////////////////////////////////////////
         // public methods
         ///////////////////////////////////////////////////////////////////////
-        Builder(int argc, char *argv[]) {
-            yes_run = false;
+        static Jobserver &get() {
+            static Jobserver instance;
+            return instance;
+        }
 
-            if (argc > 1) {
-                std::string cmd = argv[1];
-                if (cmd == "run") {
-                    yes_run = true;
-                }
+        // joins the GNU make jobserver named in MAKEFLAGS. Without one, a
+        // jobserver with <jobs> slots is created and exported through
+        // MAKEFLAGS so nested makes and -flto=jobserver share the limit.
+        void start(unsigned int jobs) {
+#ifndef _WIN32
+            if (read_fd >= 0 || joinFromMakeflags()) {
+                return;
+            }
+
+            int fds[2];
+            if (pipe(fds) != 0) {
+                return;
+            }
+            read_fd = fds[0];
+            write_fd = fds[1];
+            owner = true;
+
+            // this process holds the implicit slot, the pipe the rest
+            for (unsigned int i = 1; i < jobs; i++) {
+                release('+');
             }
+
+            slots = jobs;
+            const char *makeflags = std::getenv("MAKEFLAGS");
+            old_makeflags = makeflags == nullptr ? "" : makeflags;
+            std::string flags = " -j" + std::to_string(jobs)
+                + " --jobserver-auth=" + std::to_string(read_fd) + ","
+                + std::to_string(write_fd);
+            setenv("MAKEFLAGS", flags.c_str(), 1);
+#endif
         }
 
-        void setOptions(Options options) {
-            this->options = options;
+        void stop() {
+#ifndef _WIN32
+            if (!owner) {
+                return;
+            }
+
+            close(read_fd);
+            close(write_fd);
+            read_fd = -1;
+            write_fd = -1;
+            owner = false;
+            slots = 0;
+            if (old_makeflags == "") {
+                unsetenv("MAKEFLAGS");
+            } else {
+                setenv("MAKEFLAGS", old_makeflags.c_str(), 1);
+            }
+#endif
         }
 
-        void addIncludeDir(std::string dir) {
-            include_dirs.push_back(dir);
+        // blocks until a token is free, false when there is no jobserver
+        bool acquire(char &token) {
+#ifndef _WIN32
+            if (read_fd < 0) {
+                return false;
+            }
+
+            while (true) {
+                ssize_t n = read(read_fd, &token, 1);
+                if (n == 1) {
+                    return true;
+                } else if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+#else
+            return false;
+#endif
         }
 
-        void addSourceFile(std::string source_file) {
-            source_files.push_back(source_file);
+        // the -j limit of the jobserver in use, 0 when there is none
+        unsigned int getSlots() {
+            return slots;
         }
 
-        void addLibDir(std::string dir) {
-            lib_dirs.push_back(dir);
+        void release(char token) {
+#ifndef _WIN32
+            while (write(write_fd, &token, 1) < 0 && errno == EINTR) {
+            }
+#endif
         }
 
-        void addLibrary(std::string lib) {
-            libs.push_back(lib);
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        int read_fd = -1;
+        int write_fd = -1;
+        bool owner = false;
+        unsigned int slots = 0;
+        std::string old_makeflags = "";
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+        // understands --jobserver-auth=fifo:PATH (make 4.4) and
+        // --jobserver-auth=R,W / --jobserver-fds=R,W (older makes)
+        bool joinFromMakeflags() {
+            const char *makeflags = std::getenv("MAKEFLAGS");
+            if (makeflags == nullptr) {
+                return false;
+            }
+
+            std::string flags = makeflags;
+            std::string value = "";
+            for (std::string key : {"--jobserver-auth=", "--jobserver-fds="}) {
+                size_t at = flags.rfind(key);
+                if (at != std::string::npos) {
+                    value = flags.substr(at + key.size());
+                    value = value.substr(0, value.find(' '));
+                    break;
+                }
+            }
+            if (value == "") {
+                return false;
+            }
+
+            if (value.starts_with("fifo:")) {
+                int fd = open(value.substr(5).c_str(), O_RDWR);
+                if (fd < 0) {
+                    return false;
+                }
+                read_fd = fd;
+                write_fd = fd;
+                slots = getMakeJobs(flags);
+                return true;
+            }
+
+            size_t comma = value.find(',');
+            if (comma == std::string::npos) {
+                return false;
+            }
+            int r = std::atoi(value.substr(0, comma).c_str());
+            int w = std::atoi(value.substr(comma + 1).c_str());
+            // make only hands the pipe to rules it knows are recursive
+            if (r < 0 || w < 0 || fcntl(r, F_GETFD) == -1
+                || fcntl(w, F_GETFD) == -1) {
+                return false;
+            }
+            read_fd = r;
+            write_fd = w;
+            slots = getMakeJobs(flags);
+
+            return true;
         }
 
-        void build() {
-            createCompileCommands();
-            std::string exe = getCompileCommand();
-            std::system(exe.c_str());
+        unsigned int getMakeJobs(std::string flags) {
+            std::istringstream words(flags);
+            std::string word;
+            while (words >> word) {
+                if (word.starts_with("-j") && word.size() > 2) {
+                    return std::atoi(word.c_str() + 2);
+                }
+            }
+
+            return std::thread::hardware_concurrency();
+        }
+#endif
+};
+
+// Finds the C++ compiler (CXX, then g++ or clang++ on the PATH), its version
+// and which optional flags it accepts. Probing runs the compiler once per
+// flag, so the results are cached in ~/.config/.cppc/toolchains under a key
+// made from the whole compiler command, the path and modification time of
+// its first word and what --version prints. CXX may be a launcher such as
+// "env g++", so the binary alone does not tell compilers apart.
+class Toolchain {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        // the host compiler when <compiler> is empty
+        static Toolchain &get(std::string compiler = "") {
+            static std::mutex mutex;
+            static std::map<std::string, Toolchain> toolchains;
+            std::lock_guard<std::mutex> lock(mutex);
 
-            if (yes_run) {
-                std::string run = "./" + options.name;
-                std::system(run.c_str());
+            if (compiler == "") {
+                compiler = findHostCompiler();
             }
+            auto found = toolchains.find(compiler);
+            if (found == toolchains.end()) {
+                found = toolchains.emplace(compiler, Toolchain(compiler)).first;
+            }
+
+            return found->second;
+        }
+
+        static std::vector<std::string> getProbedFlags() {
+            return {
+                "-std=c++23", "-fmodules-ts", "-fuse-ld=mold", "-gz=zstd",
+                "-ftime-trace",
+            };
+        }
+
+        std::string getCompiler() {
+            return compiler;
+        }
+
+        // where the compiler was found, empty when it is not installed
+        std::string getPath() {
+            return path;
+        }
+
+        std::string getVersion() {
+            return version;
+        }
+
+        // changes whenever the compiler command, its binary or its version
+        // changes
+        std::string getIdentity() {
+            uint64_t hash = hashString(compiler);
+            hash = hashString(resolved_path, hash);
+
+            return hashToHex(hashString(version, hash));
+        }
+
+        bool supports(std::string flag) {
+            auto found = flags.find(flag);
+            return found != flags.end() && found->second;
         }
 
     private:
         ///////////////////////////////////////////////////////////////////////
         // private members
         ///////////////////////////////////////////////////////////////////////
-        Options options;
-        std::vector<std::string> include_dirs;
-        std::vector<std::string> source_files;
-        std::vector<std::string> lib_dirs;
-        std::vector<std::string> libs;
-        bool yes_run;
+        std::string compiler = "";
+        std::string path = "";
+        std::string resolved_path = "";
+        std::string version = "";
+        std::map<std::string, bool> flags;
 
         ///////////////////////////////////////////////////////////////////////
         // private methods
         ///////////////////////////////////////////////////////////////////////
-        void createCompileCommands() {
-            std::string filename = "compile_commands.json";
-            std::ofstream file(filename, std::ios::out);
+        Toolchain(std::string compiler) : compiler(compiler) {
+            path = findInPath(compiler);
+            if (path == "") {
+                return;
+            }
 
-            if (!file.is_open()) {
-                std::cerr << "Error: Could not open the file "
-                          << filename << std::endl;
+            std::error_code ec;
+            resolved_path = std::filesystem::canonical(path, ec).string();
+            if (ec) {
+                resolved_path = path;
+            }
+
+            // cl has no --version and takes none of the probed flags
+            if (os == "windows") {
                 return;
             }
 
-            std::vector<std::string> debug = getDebugStringList(options.debug);
-            std::string optimize = getOptimizeString(options.optimize);
-            std::string version = getVersionString(options.version);
-            std::filesystem::path cwd_path = std::filesystem::current_path();
-            std::string cwd = cwd_path.string();
-            std::string sub_root_source_path = cleanUpSubDir(options.root_source_file);
+            std::string first_line = readCommand(compiler + " --version 2>/dev/null");
+            version = first_line.substr(0, first_line.find('\n'));
 
-            file << "[" << std::endl;
-            file << "  {" << std::endl;
-            file << "    \"arguments\": [" << std::endl;
-            file << "      \"" + compiler_full_path + "\"," << std::endl;
-            file << "      \"-c\"," << std::endl;
-            for (auto d : debug) {
-                file << "      \"" << d << "\"," << std::endl;
+            auto mtime = std::filesystem::last_write_time(resolved_path, ec);
+            std::filesystem::path cache_file = getCacheDir();
+            if (!ec && cache_file != "") {
+                uint64_t key = hashString(getIdentity());
+                key = hashString(std::to_string(
+                    mtime.time_since_epoch().count()
+                ), key);
+                cache_file /= hashToHex(key);
+                if (load(cache_file)) {
+                    return;
+                }
             }
-            file << "      \"" << optimize << "\"," << std::endl;
-            file << "      \"" << version << "\"," << std::endl;
-            file << "      \"-I" << getHomePath() << "/.config/.cppc\"," << std::endl;
-            for (auto i : include_dirs) {
-                file << "      \"" << i << "\"," << std::endl;
+
+            probe();
+            if (!ec && cache_file != "") {
+                save(cache_file);
             }
-            for (auto libd : lib_dirs) {
-                file << "      \"" << libd << "\"," << std::endl;
+        }
+
+        static std::string findHostCompiler() {
+            const char *cxx = std::getenv("CXX");
+            if (cxx != nullptr && std::string(cxx) != "") {
+                return cxx;
             }
-            file << "      \"-o\"," << std::endl;
-            file << "      \"" << options.name << "\"," << std::endl;
-            file << "      \"" << options.root_source_file << "\"," << std::endl;
-            file << "    ]," << std::endl;
-            file << "    \"directory\": \"" << cwd << "\"," << std::endl;
-            file << "    \"file\": \"" << cwd << "/" << sub_root_source_path << "\"," << std::endl;
-            file << "    \"output\": \"" << cwd << "/" << options.name << "\"" << std::endl;
-            if (source_files.size() == 0) {
-                file << "  }" << std::endl;
-            } else {
-                file << "  }," << std::endl;
+
+            if (os == "windows") {
+                return "cl";
             }
-            unsigned long counter = source_files.size();
-            for (auto f : source_files) {
-                std::string minus_prefix = removeFirstTwoChars(f);
-                file << "  {" << std::endl;
-                file << "    \"arguments\": [" << std::endl;
-                file << "      \"" + compiler_full_path + "\"," << std::endl;
-                file << "      \"-c\"," << std::endl;
-                for (auto d : debug) {
-                    file << "      \"" << d << "\"," << std::endl;
-                }
-                file << "      \"" << optimize << "\"," << std::endl;
-                file << "      \"" << version << "\"," << std::endl;
-                for (auto i : include_dirs) {
-                    file << "      \"" << i << "\"," << std::endl;
-                }
-                for (auto libd : lib_dirs) {
-                    file << "      \"" << libd << "\"," << std::endl;
-                }
-                file << "      \"-o\"," << std::endl;
-                file << "      \"" << options.name << "\"," << std::endl;
-                file << "      \"" << f << "\"," << std::endl;
-                file << "    ]," << std::endl;
-                file << "    \"directory\": \"" << cwd << "\"," << std::endl;
-                file << "    \"file\": \"" << cwd << "/" << minus_prefix << "\"," << std::endl;
-                file << "    \"output\": \"" << cwd << "/" << options.name << "\"" << std::endl;
-                counter--;
-                if (counter == 0) {
-                    file << "  }" << std::endl;
-                } else {
-                    file << "  }," << std::endl;
+
+            std::vector<std::string> candidates = {"g++", "clang++"};
+            if (os == "macos") {
+                std::swap(candidates[0], candidates[1]);
+            }
+            for (auto candidate : candidates) {
+                if (findInPath(candidate) != "") {
+                    return candidate;
                 }
             }
-            file << "]" << std::endl;
 
-            file.close();
+            return candidates[0];
         }
 
-        std::vector<std::string> getDebugStringList(
-            std::vector<Debug> options
-        ) {
-            std::vector<std::string> list;
-            std::string value = "";
+        // CXX may carry a launcher or arguments, only the first word is looked up
+        static std::string findInPath(std::string compiler) {
+            std::string name = compiler.substr(0, compiler.find(' '));
+            std::error_code ec;
+            if (name.find('/') != std::string::npos
+                || name.find('\\') != std::string::npos) {
+                return std::filesystem::exists(name, ec) ? name : "";
+            }
 
-            for (auto d : options) {
-                if (os == "linux") {
-                    if (d == Debug::G) {
-                        value = "-g";
-                        list.push_back(value);
-                    } else if (d == Debug::Wall) {
-                        value = "-Wall";
-                        list.push_back(value);
-                    } else if (d == Debug::Wextra) {
-                        value = "-Wextra";
-                        list.push_back(value);
-                    } else if (d == Debug::Pedantic) {
-                        value = "-pedantic";
-                        list.push_back(value);
-                    }
-                } else if(os == "windows") {
-                    if (d == Debug::G) {
-                        value = "/ZI";
-                        list.push_back(value);
-                    } else if (d == Debug::Wall) {
-                        value = "/W4";
-                        list.push_back(value);
-                    } else if (d == Debug::Wextra) {
-                        value = "";
-                        list.push_back(value);
-                    } else if (d == Debug::Pedantic) {
-                        value = "";
-                        list.push_back(value);
+            const char *env = std::getenv("PATH");
+            if (env == nullptr) {
+                return "";
+            }
+
+#ifdef _WIN32
+            char separator = ';';
+            std::vector<std::string> suffixes = {".exe", ""};
+#else
+            char separator = ':';
+            std::vector<std::string> suffixes = {""};
+#endif
+            std::stringstream dirs(env);
+            std::string dir;
+            while (std::getline(dirs, dir, separator)) {
+                if (dir == "") {
+                    continue;
+                }
+                for (auto suffix : suffixes) {
+                    std::filesystem::path candidate =
+                        std::filesystem::path(dir) / (name + suffix);
+                    if (std::filesystem::is_regular_file(candidate, ec)) {
+                        return candidate.string();
                     }
                 }
             }
 
-            return list;
+            return "";
         }
 
-        std::string getOptimizeString(Optimize option) {
-            std::string value = "";
-            if (os == "linux") {
-                if (option == Optimize::Debug) {
-                    value = "-O0";
-                } else if (option == Optimize::Embedded) {
-                    value = "-Os";
-                } else if (option == Optimize::Release) {
-                    value = "-O3";
-                }
+        static std::filesystem::path getCacheDir() {
+            const char *home = std::getenv("HOME");
+            if (home == nullptr) {
+                return "";
+            }
+
+            return std::filesystem::path(home) / ".config" / ".cppc"
+                / "toolchains";
+        }
+
+        // compiles and links an empty program with each flag in a scratch
+        // directory so the outputs some flags write do not land in the project
+        void probe() {
+            std::filesystem::path dir = std::filesystem::temp_directory_path()
+                / ("cppc-probe-" + getTempSuffix());
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            {
+                std::ofstream file(dir / "probe.cpp");
+                file << "int main() { return 0; }" << std::endl;
+            }
+
+            for (auto flag : getProbedFlags()) {
+                std::string command = "cd " + dir.string() + " && " + compiler
+                    + " " + flag + " probe.cpp -o probe > /dev/null 2>&1";
+                flags[flag] = std::system(command.c_str()) == 0;
+            }
+
+            std::filesystem::remove_all(dir, ec);
+        }
+
+        // "version <text>" then one "<0|1> <flag>" line per probed flag
+        bool load(std::filesystem::path cache_file) {
+            std::ifstream file(cache_file);
+            std::string line;
+            if (!file.is_open() || !std::getline(file, line)
+                || line != "version " + version) {
+                return false;
+            }
+
+            while (std::getline(file, line)) {
+                if (line.size() > 2) {
+                    flags[line.substr(2)] = line[0] == '1';
+                }
+            }
+
+            return flags.size() == getProbedFlags().size();
+        }
+
+        void save(std::filesystem::path cache_file) {
+            std::error_code ec;
+            std::filesystem::create_directories(cache_file.parent_path(), ec);
+            std::filesystem::path tmp = cache_file;
+            tmp += ".tmp-" + getTempSuffix();
+            {
+                std::ofstream file(tmp);
+                file << "version " << version << std::endl;
+                for (auto &[flag, supported] : flags) {
+                    file << (supported ? "1 " : "0 ") << flag << std::endl;
+                }
+            }
+            std::filesystem::rename(tmp, cache_file, ec);
+            if (ec) {
+                std::filesystem::remove(tmp, ec);
+            }
+        }
+};
+
+class JobPool {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        JobPool(unsigned int jobs) {
+            this->jobs = jobs == 0 ? 1 : jobs;
+            next = 0;
+            active = 0;
+        }
+
+        // jobs may add more jobs while the pool is running, run() returns
+        // once the queue is drained and every worker is idle
+        size_t add(std::function<int()> job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(job);
+            results.push_back(0);
+            cv.notify_one();
+            return queue.size() - 1;
+        }
+
+        size_t addCommand(std::string command) {
+            return add([command]() {
+                return std::system(command.c_str());
+            });
+        }
+
+        std::vector<int> run() {
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < jobs; i++) {
+                workers.emplace_back([this, i]() { work(i == 0); });
+            }
+            for (auto &w : workers) {
+                w.join();
+            }
+
+            return results;
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        unsigned int jobs;
+        size_t next;
+        size_t active;
+        std::vector<std::function<int()>> queue;
+        std::vector<int> results;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        // the first worker runs on the implicit jobserver slot, the others
+        // hold a token for as long as a job runs
+        void work(bool implicit_slot) {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cv.wait(lock, [this]() {
+                    return next < queue.size() || active == 0;
+                });
+                if (next >= queue.size()) {
+                    cv.notify_all();
+                    return;
+                }
+
+                size_t index = next++;
+                std::function<int()> job = queue[index];
+                active++;
+                lock.unlock();
+                char token = 0;
+                bool has_token = !implicit_slot
+                    && Jobserver::get().acquire(token);
+                int status = job();
+                if (has_token) {
+                    Jobserver::get().release(token);
+                }
+                lock.lock();
+                results[index] = status;
+                active--;
+                cv.notify_all();
+            }
+        }
+};
+
+// Expands source globs such as "src/**/*.cpp". Directories are listed in
+// parallel and each listing is cached with the directory's mtime, so an
+// unchanged subtree costs one stat per directory instead of a walk. Adding
+// or removing a file changes its directory's mtime, which drops just that
+// listing from the cache.
+class SourceScanner {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        SourceScanner(std::string cache_file, std::string skip_dir) {
+            this->cache_file = cache_file;
+            this->skip_dir = skip_dir;
+            load();
+        }
+
+        // "*" and "?" match within a path segment, "**" matches any number
+        // of directories. An exclude that matches a directory drops
+        // everything under it. Results are sorted and relative patterns
+        // come back as "./path" like hand-added sources.
+        std::vector<std::string> scan(
+            std::string pattern,
+            std::vector<std::string> excludes
+        ) {
+            bool absolute = pattern.size() > 0 && pattern[0] == '/';
+            std::string prefix = absolute ? "/" : "./";
+            std::vector<std::string> parts = splitPath(pattern);
+            std::vector<std::vector<std::string>> exclude_parts;
+            for (auto exclude : excludes) {
+                exclude_parts.push_back(splitPath(exclude));
+            }
+
+            std::vector<std::string> base;
+            bool recursive = false;
+            for (auto part : parts) {
+                if (part == "**") {
+                    recursive = true;
+                }
+            }
+            for (auto part : parts) {
+                if (part.find_first_of("*?") != std::string::npos) {
+                    break;
+                }
+                base.push_back(part);
+            }
+
+            std::vector<std::string> found;
+            if (base.size() == parts.size()) {
+                std::error_code ec;
+                if (std::filesystem::is_regular_file(pattern, ec)) {
+                    found.push_back(pattern);
+                }
+                return found;
+            }
+
+            auto isExcluded = [&](const std::vector<std::string> &path) {
+                for (auto &exclude : exclude_parts) {
+                    for (size_t n = 1; n <= path.size(); n++) {
+                        std::vector<std::string> head(
+                            path.begin(), path.begin() + n
+                        );
+                        if (matchParts(exclude, 0, head, 0)) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            };
+
+            std::mutex found_mutex;
+            JobPool pool(std::thread::hardware_concurrency());
+            std::function<void(std::vector<std::string>)> visit;
+            visit = [&](std::vector<std::string> dir) {
+                pool.add([&, dir]() {
+                    Listing listing = list(prefix + joinPath(dir));
+                    for (auto name : listing.files) {
+                        std::vector<std::string> path = dir;
+                        path.push_back(name);
+                        if (matchParts(parts, 0, path, 0) && !isExcluded(path)) {
+                            std::lock_guard<std::mutex> lock(found_mutex);
+                            found.push_back(prefix + joinPath(path));
+                        }
+                    }
+                    for (auto name : listing.dirs) {
+                        std::vector<std::string> path = dir;
+                        path.push_back(name);
+                        bool deeper = recursive || path.size() + 1 < parts.size();
+                        if (deeper && !isExcluded(path)) {
+                            visit(path);
+                        }
+                    }
+                    return 0;
+                });
+            };
+            visit(base);
+            pool.run();
+
+            std::sort(found.begin(), found.end());
+            save();
+
+            return found;
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        struct Listing {
+            std::string mtime;
+            std::vector<std::string> files;
+            std::vector<std::string> dirs;
+        };
+
+        std::string cache_file;
+        std::string skip_dir;
+        std::map<std::string, Listing> cache;
+        std::set<std::string> visited;
+        bool dirty = false;
+        std::mutex mutex;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        Listing list(std::string dir) {
+            std::error_code ec;
+            auto write_time = std::filesystem::last_write_time(dir, ec);
+            if (ec) {
+                return Listing{};
+            }
+            std::string mtime = std::to_string(
+                write_time.time_since_epoch().count()
+            );
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                visited.insert(dir);
+                auto cached = cache.find(dir);
+                if (cached != cache.end() && cached->second.mtime == mtime) {
+                    return cached->second;
+                }
+            }
+
+            Listing listing{mtime, {}, {}};
+            for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+                std::string name = entry.path().filename().string();
+                std::error_code entry_ec;
+                if (entry.is_regular_file(entry_ec)) {
+                    listing.files.push_back(name);
+                } else if (entry.is_directory(entry_ec)
+                    && !entry.is_symlink(entry_ec) && name[0] != '.'
+                    && name != skip_dir) {
+                    listing.dirs.push_back(name);
+                }
+            }
+
+            // a directory changed within the mtime granularity of now could
+            // change again without its mtime moving, so it is not cached
+            auto age = std::filesystem::file_time_type::clock::now() - write_time;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (age > std::chrono::seconds(2)) {
+                cache[dir] = listing;
+            } else {
+                cache.erase(dir);
+            }
+            dirty = true;
+
+            return listing;
+        }
+
+        // "d <mtime> <dir>" followed by "f <name>" and "s <subdir>" lines
+        void load() {
+            std::ifstream file(cache_file);
+            std::string line;
+            Listing *listing = nullptr;
+            while (std::getline(file, line)) {
+                if (line.size() < 2) {
+                    continue;
+                }
+
+                std::string value = line.substr(2);
+                if (line[0] == 'd') {
+                    size_t space = value.find(' ');
+                    if (space == std::string::npos) {
+                        listing = nullptr;
+                        continue;
+                    }
+                    listing = &cache[value.substr(space + 1)];
+                    listing->mtime = value.substr(0, space);
+                } else if (listing != nullptr && line[0] == 'f') {
+                    listing->files.push_back(value);
+                } else if (listing != nullptr && line[0] == 's') {
+                    listing->dirs.push_back(value);
+                }
+            }
+        }
+
+        // only directories this scanner has seen are kept so deleted ones
+        // fall out of the cache
+        void save() {
+            if (!dirty) {
+                return;
+            }
+
+            std::error_code ec;
+            std::filesystem::path path = cache_file;
+            std::filesystem::create_directories(path.parent_path(), ec);
+            std::filesystem::path tmp = path;
+            tmp += ".tmp-" + getTempSuffix();
+            {
+                std::ofstream file(tmp);
+                for (auto &[dir, listing] : cache) {
+                    if (visited.count(dir) == 0) {
+                        continue;
+                    }
+                    file << "d " << listing.mtime << " " << dir << "\n";
+                    for (auto &name : listing.files) {
+                        file << "f " << name << "\n";
+                    }
+                    for (auto &name : listing.dirs) {
+                        file << "s " << name << "\n";
+                    }
+                }
+            }
+            std::filesystem::rename(tmp, path, ec);
+            if (ec) {
+                std::filesystem::remove(tmp, ec);
+            }
+            dirty = false;
+        }
+
+        static std::vector<std::string> splitPath(std::string path) {
+            std::vector<std::string> parts;
+            std::stringstream stream(path);
+            std::string part;
+            while (std::getline(stream, part, '/')) {
+                if (part != "" && part != ".") {
+                    parts.push_back(part);
+                }
+            }
+
+            return parts;
+        }
+
+        static std::string joinPath(std::vector<std::string> parts) {
+            std::string path = "";
+            for (auto part : parts) {
+                path += (path == "" ? "" : "/") + part;
+            }
+
+            return path;
+        }
+
+        static bool matchParts(
+            const std::vector<std::string> &pattern,
+            size_t p,
+            const std::vector<std::string> &path,
+            size_t s
+        ) {
+            if (p == pattern.size()) {
+                return s == path.size();
+            }
+
+            if (pattern[p] == "**") {
+                for (size_t next = s; next <= path.size(); next++) {
+                    if (matchParts(pattern, p + 1, path, next)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            return s < path.size() && matchName(pattern[p], path[s])
+                && matchParts(pattern, p + 1, path, s + 1);
+        }
+
+        static bool matchName(std::string pattern, std::string name) {
+            size_t p = 0;
+            size_t n = 0;
+            size_t star = std::string::npos;
+            size_t retry = 0;
+            while (n < name.size()) {
+                if (p < pattern.size()
+                    && (pattern[p] == '?' || pattern[p] == name[n])) {
+                    p++;
+                    n++;
+                } else if (p < pattern.size() && pattern[p] == '*') {
+                    star = p++;
+                    retry = n;
+                } else if (star != std::string::npos) {
+                    p = star + 1;
+                    n = ++retry;
+                } else {
+                    return false;
+                }
+            }
+            while (p < pattern.size() && pattern[p] == '*') {
+                p++;
+            }
+
+            return p == pattern.size();
+        }
+};
+
+class SizeAnalyzer {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public members
+        ///////////////////////////////////////////////////////////////////////
+        std::string path;
+        uint64_t file_size = 0;
+        std::map<std::string, uint64_t> sections;
+        std::map<std::string, uint64_t> symbols;
+        std::map<std::string, uint64_t> families;
+        std::map<std::string, uint64_t> family_counts;
+        std::map<std::string, uint64_t> objects;
+
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        // reads the section headers and symbol table of a 64-bit little
+        // endian ELF file, the map file is optional and gives sizes per object
+        bool load(std::string elf_path, std::string map_path = "") {
+            path = elf_path;
+            std::ifstream file(elf_path, std::ios::binary);
+            if (!file.is_open()) {
+                std::cerr << "Error: Could not open the file "
+                          << elf_path << std::endl;
+                return false;
+            }
+            data.assign(
+                std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>()
+            );
+            file_size = data.size();
+
+            if (data.size() < 64 || data.compare(0, 4, "\x7f" "ELF") != 0
+                || data[4] != 2 || data[5] != 1) {
+                std::cerr << "Error: " << elf_path
+                          << " is not a 64-bit little endian ELF file"
+                          << std::endl;
+                return false;
+            }
+
+            uint64_t shoff = read(0x28, 8);
+            uint64_t shentsize = read(0x3a, 2);
+            uint64_t shnum = read(0x3c, 2);
+            uint64_t shstrndx = read(0x3e, 2);
+            if (shoff + shnum * shentsize > data.size() || shstrndx >= shnum) {
+                std::cerr << "Error: " << elf_path
+                          << " has a truncated section table" << std::endl;
+                return false;
+            }
+
+            std::vector<ElfSection> headers;
+            for (uint64_t i = 0; i < shnum; i++) {
+                uint64_t at = shoff + i * shentsize;
+                headers.push_back(ElfSection{
+                    .name = (uint32_t)read(at, 4),
+                    .type = (uint32_t)read(at + 4, 4),
+                    .flags = read(at + 8, 8),
+                    .offset = read(at + 24, 8),
+                    .size = read(at + 32, 8),
+                    .link = (uint32_t)read(at + 40, 4),
+                });
+            }
+
+            uint64_t shstr = headers[shstrndx].offset;
+            const ElfSection *symtab = nullptr;
+            for (auto &h : headers) {
+                if (h.flags & 0x2) {
+                    sections[readString(shstr + h.name)] += h.size;
+                }
+                if (h.type == 2) {
+                    symtab = &h;
+                } else if (h.type == 11 && symtab == nullptr) {
+                    symtab = &h;
+                }
+            }
+
+            if (symtab != nullptr && symtab->link < headers.size()) {
+                uint64_t strtab = headers[symtab->link].offset;
+                for (uint64_t at = symtab->offset;
+                     at + 24 <= symtab->offset + symtab->size; at += 24) {
+                    uint64_t size = read(at + 16, 8);
+                    uint64_t type = read(at + 4, 1) & 0xf;
+                    if (size == 0 || (type != 1 && type != 2)) {
+                        continue;
+                    }
+
+                    std::string name = demangle(
+                        readString(strtab + read(at, 4))
+                    );
+                    std::string family = getFamily(name);
+                    symbols[name] += size;
+                    families[family] += size;
+                    family_counts[family]++;
+                }
+            }
+
+            if (map_path != "") {
+                loadMapFile(map_path);
+            }
+
+            return true;
+        }
+
+        uint64_t getAllocatedSize() {
+            uint64_t total = 0;
+            for (auto &[name, size] : sections) {
+                total += size;
+            }
+
+            return total;
+        }
+
+        void printReport(size_t top) {
+            std::cout << path << ": " << getAllocatedSize()
+                      << " bytes loaded, " << file_size
+                      << " bytes on disk" << std::endl;
+
+            printTable("Sections", sections, top, nullptr);
+            if (!objects.empty()) {
+                printTable("Object files", objects, top, nullptr);
+            }
+            printTable("Symbols", symbols, top, nullptr);
+            printTable("Template families", families, top, &family_counts);
+        }
+
+        // prints every row that changed between two builds, returns the
+        // growth of the loaded size in bytes (negative when it shrank)
+        static int64_t printDiff(SizeAnalyzer &before, SizeAnalyzer &after,
+                                 size_t top) {
+            int64_t growth = (int64_t)after.getAllocatedSize()
+                - (int64_t)before.getAllocatedSize();
+
+            std::cout << before.path << " -> " << after.path << ": "
+                      << before.getAllocatedSize() << " -> "
+                      << after.getAllocatedSize() << " bytes loaded ("
+                      << formatDelta(growth) << ")" << std::endl;
+
+            printDiffTable("Sections", before.sections, after.sections, top);
+            if (!before.objects.empty() && !after.objects.empty()) {
+                printDiffTable("Object files", before.objects,
+                               after.objects, top);
+            }
+            printDiffTable("Symbols", before.symbols, after.symbols, top);
+            printDiffTable("Template families", before.families,
+                           after.families, top);
+
+            return growth;
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private structs
+        ///////////////////////////////////////////////////////////////////////
+        struct ElfSection {
+            uint32_t name;
+            uint32_t type;
+            uint64_t flags;
+            uint64_t offset;
+            uint64_t size;
+            uint32_t link;
+        };
+
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        std::string data;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        uint64_t read(uint64_t offset, int bytes) {
+            uint64_t value = 0;
+            if (offset + bytes > data.size()) {
+                return 0;
+            }
+            for (int i = bytes - 1; i >= 0; i--) {
+                value = (value << 8) | (unsigned char)data[offset + i];
+            }
+
+            return value;
+        }
+
+        std::string readString(uint64_t offset) {
+            if (offset >= data.size()) {
+                return "";
+            }
+
+            return std::string(data.c_str() + offset);
+        }
+
+        static std::string demangle(std::string name) {
+            size_t version = name.find('@');
+            if (version != std::string::npos) {
+                name = name.substr(0, version);
+            }
+#if defined(__GNUC__) || defined(__clang__)
+            int status = 0;
+            char *result = abi::__cxa_demangle(
+                name.c_str(), nullptr, nullptr, &status
+            );
+            if (status == 0 && result != nullptr) {
+                name = result;
+            }
+            std::free(result);
+#endif
+            return name;
+        }
+
+        // collapses template arguments and drops the parameter list so that
+        // every instantiation of a template lands in the same family
+        static std::string getFamily(std::string name) {
+            std::string family = "";
+            int depth = 0;
+
+            for (size_t i = 0; i < name.size(); i++) {
+                char c = name[i];
+                if (depth == 0 && c == '(') {
+                    if (name.compare(i, 21, "(anonymous namespace)") == 0) {
+                        family += "(anonymous namespace)";
+                        i += 20;
+                        continue;
+                    }
+                    break;
+                }
+                if (depth == 0 && family.ends_with("operator")
+                    && (c == '<' || c == '>')) {
+                    family += c;
+                    continue;
+                }
+                if (c == '<') {
+                    if (depth == 0) {
+                        family += "<>";
+                    }
+                    depth++;
+                } else if (c == '>' && depth > 0) {
+                    depth--;
+                } else if (depth == 0) {
+                    family += c;
+                }
+            }
+
+            return family;
+        }
+
+        // sums input section sizes per object file from a GNU ld or gold
+        // map file, sections that are not loaded have address zero
+        void loadMapFile(std::string map_path) {
+            std::ifstream file(map_path);
+            if (!file.is_open()) {
+                return;
+            }
+
+            std::string line;
+            bool in_map = false;
+            while (std::getline(file, line)) {
+                if (!in_map) {
+                    std::string lower = line;
+                    std::transform(lower.begin(), lower.end(),
+                                   lower.begin(), ::tolower);
+                    in_map = lower.find("memory map") != std::string::npos;
+                    continue;
+                }
+                if (line.size() < 2 || line[0] != ' ' || line[1] != '.') {
+                    continue;
+                }
+
+                std::vector<std::string> words = splitWords(line);
+                if (words.size() == 1) {
+                    std::string next;
+                    std::getline(file, next);
+                    for (auto w : splitWords(next)) {
+                        words.push_back(w);
+                    }
+                }
+                if (words.size() < 4 || !words[1].starts_with("0x")
+                    || !words[2].starts_with("0x")) {
+                    continue;
+                }
+
+                uint64_t address = std::stoull(words[1], nullptr, 16);
+                uint64_t size = std::stoull(words[2], nullptr, 16);
+                if (address == 0 || size == 0) {
+                    continue;
+                }
+
+                std::string object = words[3];
+                for (size_t i = 4; i < words.size(); i++) {
+                    object += " " + words[i];
+                }
+                if (object.starts_with("/")) {
+                    object = std::filesystem::path(object).filename().string();
+                }
+                objects[object] += size;
+            }
+        }
+
+        static std::vector<std::string> splitWords(std::string line) {
+            std::vector<std::string> words;
+            std::istringstream stream(line);
+            std::string word;
+            while (stream >> word) {
+                words.push_back(word);
+            }
+
+            return words;
+        }
+
+        static std::string formatDelta(int64_t delta) {
+            return (delta > 0 ? "+" : "") + std::to_string(delta);
+        }
+
+        static void printTable(
+            std::string title,
+            std::map<std::string, uint64_t> &rows,
+            size_t top,
+            std::map<std::string, uint64_t> *counts
+        ) {
+            std::vector<std::pair<std::string, uint64_t>> sorted(
+                rows.begin(), rows.end()
+            );
+            std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+                return a.second > b.second;
+            });
+
+            std::cout << "\n" << title << std::endl;
+            for (size_t i = 0; i < sorted.size() && i < top; i++) {
+                std::cout << "  " << std::to_string(sorted[i].second);
+                if (counts != nullptr) {
+                    std::cout << "  " << (*counts)[sorted[i].first] << "x";
+                }
+                std::cout << "  " << sorted[i].first << std::endl;
+            }
+        }
+
+        static void printDiffTable(
+            std::string title,
+            std::map<std::string, uint64_t> &before,
+            std::map<std::string, uint64_t> &after,
+            size_t top
+        ) {
+            std::map<std::string, int64_t> deltas;
+            for (auto &[name, size] : before) {
+                deltas[name] -= (int64_t)size;
+            }
+            for (auto &[name, size] : after) {
+                deltas[name] += (int64_t)size;
+            }
+
+            std::vector<std::pair<std::string, int64_t>> sorted;
+            for (auto &[name, delta] : deltas) {
+                if (delta != 0) {
+                    sorted.push_back({name, delta});
+                }
+            }
+            std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+                return std::llabs(a.second) > std::llabs(b.second);
+            });
+
+            std::cout << "\n" << title << std::endl;
+            for (size_t i = 0; i < sorted.size() && i < top; i++) {
+                std::cout << "  " << formatDelta(sorted[i].second)
+                          << "  " << sorted[i].first << std::endl;
+            }
+        }
+};
+
+class Builder {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        Builder(int argc, char *argv[]) {
+            yes_run = false;
+            yes_size = false;
+            yes_test = false;
+
+            if (argc > 1) {
+                std::string cmd = argv[1];
+                if (cmd == "run") {
+                    yes_run = true;
+                } else if (cmd == "size") {
+                    yes_size = true;
+                } else if (cmd == "test") {
+                    yes_test = true;
+                }
+            }
+
+            for (int i = 2; i < argc; i++) {
+                command_args.push_back(argv[i]);
+            }
+
+            // CPPC_WORKERS=unix:/tmp/w1.sock,buildbox:7070
+            const char *workers = std::getenv("CPPC_WORKERS");
+            if (workers != nullptr) {
+                std::istringstream list(workers);
+                std::string address;
+                while (std::getline(list, address, ',')) {
+                    if (address != "") {
+                        remote.addWorker(address);
+                    }
+                }
+            }
+        }
+
+        void setOptions(Options options) {
+            this->options = options;
+        }
+
+        void addIncludeDir(std::string dir) {
+            include_dirs.push_back(dir);
+        }
+
+        void addSourceFile(std::string source_file) {
+            source_files.push_back(source_file);
+        }
+
+        // adds every file matching a glob such as "src/**/*.cpp" except
+        // those matching one of <excludes>, see SourceScanner. The root
+        // source file and tests are left out even when they match.
+        void addSources(
+            std::string pattern,
+            std::vector<std::string> excludes = {}
+        ) {
+            // one scanner for every glob, so sources.cache keeps the
+            // directories of all of them
+            if (scanner == nullptr) {
+                scanner = std::make_unique<SourceScanner>(
+                    build_dir + "/sources.cache", build_dir
+                );
+            }
+            for (auto source_file : scanner->scan(pattern, excludes)) {
+                if (std::find(source_files.begin(), source_files.end(),
+                              source_file) == source_files.end()) {
+                    source_files.push_back(source_file);
+                }
+            }
+        }
+
+        void addLibDir(std::string dir) {
+            lib_dirs.push_back(dir);
+        }
+
+        void addLibrary(std::string lib) {
+            libs.push_back(lib);
+        }
+
+        // a test is one source file with its own main, it is linked with
+        // every source file except the root one and passes when it exits 0
+        void addTest(std::string test_file) {
+            test_files.push_back(test_file);
+        }
+
+        // debug builds link every source directory as its own shared
+        // library so an edit only relinks a small .so, release builds are
+        // unaffected
+        void enableComponentBuild() {
+            component_build = true;
+        }
+
+        // defines CPPC_INSTRUMENT so the zones and counters from
+        // instrument.h record and write a Chrome trace at exit
+        void enableInstrumentation() {
+            instrumentation = true;
+        }
+
+        // compiles are preprocessed locally and sent to "cppc worker"
+        // processes, see remote.h for the address format
+        void addRemoteWorker(std::string address) {
+            remote.addWorker(address);
+        }
+
+        // builds a vendored library once per source hash, compiler and
+        // flags into ~/.config/.cppc/store and links it from there. Without
+        // a recipe command every source under the recipe's source_dirs
+        // (default "src") is compiled into lib<name>.a, .c files with the C
+        // compiler. A recipe command is run inside the dependency with
+        // CPPC_PREFIX, CXX, CXXFLAGS, CC and CFLAGS set and has to install
+        // lib/ (and optionally include/) into CPPC_PREFIX.
+        void addVendoredDependency(std::string path, Recipe recipe) {
+            if (recipe.name == "") {
+                recipe.name = std::filesystem::path(path).filename().string();
+            }
+            if (recipe.include_dirs.empty()) {
+                recipe.include_dirs.push_back("include");
+            }
+            if (recipe.source_dirs.empty()) {
+                recipe.source_dirs.push_back("src");
+            }
+            vendored_deps.push_back({path, recipe});
+        }
+
+        void build() {
+            if (yes_size && !command_args.empty()
+                && command_args[0] == "--diff") {
+                diffSizes();
+                return;
+            }
+            if (yes_test) {
+                runTests();
+                return;
+            }
+
+            bool profile_run = yes_run && hasArg("--profile");
+            if (profile_run && !useProfileVariant()) {
+                std::exit(1);
+            }
+            if (!profile_run) {
+                createCompileCommands();
+            }
+            if (options.reproducible) {
+                setSourceDateEpoch();
+            }
+            Jobserver::get().start(getJobCount() * (1 + remote.size()));
+
+            std::set<Targets> targets = getTargets();
+            std::map<Targets, TargetBuild> builds;
+            bool build_failed = false;
+            JobPool pool(getJobCount());
+
+            for (Targets target : targets) {
+                if (getCompilerForTarget(target) == "") {
+                    std::cerr << "Error: " << getTargetName(target)
+                              << " target is not supported on " << os
+                              << std::endl;
+                    build_failed = true;
+                    continue;
+                }
+
+                TargetBuild &tb = builds[target];
+                if (!prepareVendoredDependencies(target)) {
+                    tb.failed = true;
+                    continue;
+                }
+
+                std::vector<std::string> sources = getSourceFiles();
+                if (options.reproducible) {
+                    std::sort(sources.begin(), sources.end());
+                }
+                sources.insert(sources.begin(), options.root_source_file);
+
+                std::vector<std::string> stale;
+                for (auto src : sources) {
+                    std::string obj = getObjectPath(target, src);
+                    tb.objects.push_back(obj);
+                    std::string command = getCompileCommand(target, src, obj);
+                    if (!isObjectUpToDate(src, obj, command)) {
+                        stale.push_back(src);
+                    }
+                }
+
+                tb.remaining = stale.size();
+                if (stale.size() == 0) {
+                    addLinkJobs(pool, target, tb);
+                    continue;
+                }
+
+                for (auto src : stale) {
+                    std::string obj = getObjectPath(target, src);
+                    std::string command = getCompileCommand(target, src, obj);
+                    pool.add([this, &pool, &tb, target, src, obj, command]() {
+                        std::filesystem::create_directories(
+                            std::filesystem::path(obj).parent_path()
+                        );
+                        int status = compileObject(target, src, obj, command);
+                        if (status == 0) {
+                            writeCommandStamp(obj, command);
+                            addObjectBytesWritten(obj);
+                        } else {
+                            tb.failed = true;
+                        }
+                        if (--tb.remaining == 0 && !tb.failed) {
+                            addLinkJobs(pool, target, tb);
+                        }
+                        return status;
+                    });
+                }
+            }
+
+            pool.run();
+            Jobserver::get().stop();
+            reportBytesWritten();
+
+            bool host_built = false;
+            for (auto &[target, tb] : builds) {
+                if (tb.failed || tb.link_failed) {
+                    std::cerr << "Error: build failed for target "
+                              << getTargetName(target) << std::endl;
+                    build_failed = true;
+                    continue;
+                } else if (target == getHostTarget()) {
+                    host_built = true;
+                }
+
+                if (yes_size) {
+                    reportSize(target, tb.objects);
+                }
+            }
+
+            if (yes_run && host_built) {
+                std::string run = "./" + getOutputName(getHostTarget());
+                if (profile) {
+                    runProfile(run);
+                } else {
+                    std::system(run.c_str());
+                }
+            }
+
+            // lets build.cpp, make and CI see the failure
+            if (build_failed) {
+                std::exit(1);
+            }
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private structs
+        ///////////////////////////////////////////////////////////////////////
+        struct TargetBuild {
+            std::vector<std::string> objects;
+            std::atomic<size_t> remaining = 0;
+            std::atomic<bool> failed = false;
+            std::atomic<bool> link_failed = false;
+            std::atomic<size_t> links_remaining = 0;
+        };
+
+        struct TestRun {
+            std::string name;
+            std::string binary;
+            std::string link_command;
+            std::vector<std::string> sources;
+            std::vector<std::string> objects;
+            std::vector<std::string> reasons;
+            bool selected = false;
+        };
+
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        std::string build_dir = "cppc-build";
+        Options options;
+        std::vector<std::string> include_dirs;
+        std::vector<std::string> source_files;
+        std::vector<std::string> lib_dirs;
+        std::vector<std::string> libs;
+        std::vector<std::string> test_files;
+        std::vector<std::string> command_args;
+        std::vector<std::pair<std::string, Recipe>> vendored_deps;
+        std::map<Targets, std::vector<std::string>> dep_compile_flags;
+        std::map<Targets, std::vector<std::string>> dep_link_flags;
+        RemoteClient remote;
+        std::unique_ptr<SourceScanner> scanner;
+        bool component_build = false;
+        bool profile = false;
+        bool instrumentation = false;
+        std::atomic<uint64_t> bytes_objects = 0;
+        std::atomic<uint64_t> bytes_debug = 0;
+        std::atomic<uint64_t> bytes_outputs = 0;
+        bool yes_run;
+        bool yes_size;
+        bool yes_test;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        void createCompileCommands() {
+            std::string filename = "compile_commands.json";
+            std::ofstream file(filename, std::ios::out);
+
+            if (!file.is_open()) {
+                std::cerr << "Error: Could not open the file "
+                          << filename << std::endl;
+                return;
+            }
+
+            std::vector<std::string> debug = getDebugStringList(options.debug);
+            std::string optimize = getOptimizeString(options.optimize);
+            std::string version = getVersionString(options.version);
+            std::filesystem::path cwd_path = std::filesystem::current_path();
+            std::string cwd = cwd_path.string();
+            std::string sub_root_source_path = cleanUpSubDir(options.root_source_file);
+
+            file << "[" << std::endl;
+            file << "  {" << std::endl;
+            file << "    \"arguments\": [" << std::endl;
+            file << "      \"" + Toolchain::get().getPath() + "\"," << std::endl;
+            file << "      \"-c\"," << std::endl;
+            for (auto d : debug) {
+                file << "      \"" << d << "\"," << std::endl;
+            }
+            file << "      \"" << optimize << "\"," << std::endl;
+            file << "      \"" << version << "\"," << std::endl;
+            file << "      \"-I" << getHomePath() << "/.config/.cppc\"," << std::endl;
+            for (auto i : include_dirs) {
+                file << "      \"" << i << "\"," << std::endl;
+            }
+            for (auto libd : lib_dirs) {
+                file << "      \"" << libd << "\"," << std::endl;
+            }
+            file << "      \"-o\"," << std::endl;
+            file << "      \"" << options.name << "\"," << std::endl;
+            file << "      \"" << options.root_source_file << "\"," << std::endl;
+            file << "    ]," << std::endl;
+            file << "    \"directory\": \"" << cwd << "\"," << std::endl;
+            file << "    \"file\": \"" << cwd << "/" << sub_root_source_path << "\"," << std::endl;
+            file << "    \"output\": \"" << cwd << "/" << options.name << "\"" << std::endl;
+            std::vector<std::string> sources = getSourceFiles();
+            if (sources.size() == 0) {
+                file << "  }" << std::endl;
+            } else {
+                file << "  }," << std::endl;
+            }
+            unsigned long counter = sources.size();
+            for (auto f : sources) {
+                std::string minus_prefix = removeFirstTwoChars(f);
+                file << "  {" << std::endl;
+                file << "    \"arguments\": [" << std::endl;
+                file << "      \"" + Toolchain::get().getPath() + "\"," << std::endl;
+                file << "      \"-c\"," << std::endl;
+                for (auto d : debug) {
+                    file << "      \"" << d << "\"," << std::endl;
+                }
+                file << "      \"" << optimize << "\"," << std::endl;
+                file << "      \"" << version << "\"," << std::endl;
+                for (auto i : include_dirs) {
+                    file << "      \"" << i << "\"," << std::endl;
+                }
+                for (auto libd : lib_dirs) {
+                    file << "      \"" << libd << "\"," << std::endl;
+                }
+                file << "      \"-o\"," << std::endl;
+                file << "      \"" << options.name << "\"," << std::endl;
+                file << "      \"" << f << "\"," << std::endl;
+                file << "    ]," << std::endl;
+                file << "    \"directory\": \"" << cwd << "\"," << std::endl;
+                file << "    \"file\": \"" << cwd << "/" << minus_prefix << "\"," << std::endl;
+                file << "    \"output\": \"" << cwd << "/" << options.name << "\"" << std::endl;
+                counter--;
+                if (counter == 0) {
+                    file << "  }" << std::endl;
+                } else {
+                    file << "  }," << std::endl;
+                }
+            }
+            file << "]" << std::endl;
+
+            file.close();
+        }
+
+        std::vector<std::string> getDebugStringList(
+            std::vector<Debug> options
+        ) {
+            std::vector<std::string> list;
+            std::string value = "";
+
+            for (auto d : options) {
+                if (os == "linux") {
+                    if (d == Debug::G) {
+                        value = "-g";
+                        list.push_back(value);
+                    } else if (d == Debug::Wall) {
+                        value = "-Wall";
+                        list.push_back(value);
+                    } else if (d == Debug::Wextra) {
+                        value = "-Wextra";
+                        list.push_back(value);
+                    } else if (d == Debug::Pedantic) {
+                        value = "-pedantic";
+                        list.push_back(value);
+                    }
+                } else if(os == "windows") {
+                    if (d == Debug::G) {
+                        value = "/ZI";
+                        list.push_back(value);
+                    } else if (d == Debug::Wall) {
+                        value = "/W4";
+                        list.push_back(value);
+                    } else if (d == Debug::Wextra) {
+                        value = "";
+                        list.push_back(value);
+                    } else if (d == Debug::Pedantic) {
+                        value = "";
+                        list.push_back(value);
+                    }
+                }
+            }
+
+            return list;
+        }
+
+        std::string getOptimizeString(Optimize option) {
+            std::string value = "";
+            if (os == "linux") {
+                if (option == Optimize::Debug) {
+                    value = "-O0";
+                } else if (option == Optimize::Embedded) {
+                    value = "-Os";
+                } else if (option == Optimize::Release) {
+                    value = "-O3";
+                }
             } else if(os == "windows") {
                 if (option == Optimize::Debug) {
                     value = "/Od";
                 } else if (option == Optimize::Embedded) {
-                    value = "O1";
+                    value = "/O1";
                 } else if (option == Optimize::Release) {
                     value = "/O2";
                 }
             }
 
-            return value;
+            return value;
+        }
+
+        std::string getVersionString(Version option) {
+            std::string value = "";
+            if (os == "linux") {
+                if (option == Version::V11) {
+                    value = "-std=c++11";
+                } else if (option == Version::V14) {
+                    value = "-std=c++14";
+                } else if (option == Version::V17) {
+                    value = "-std=c++17";
+                } else if (option == Version::V20) {
+                    value = "-std=c++20";
+                } else if (option == Version::V23) {
+                    // compilers that predate the final name spell it c++2b
+                    value = Toolchain::get().supports("-std=c++23")
+                        ? "-std=c++23" : "-std=c++2b";
+                }
+            } else if (os == "windows") {
+                if (option == Version::V11) {
+                    value = "/std:c++11";
+                } else if (option == Version::V14) {
+                    value = "/std:c++14";
+                } else if (option == Version::V17) {
+                    value = "/std:c++17";
+                } else if (option == Version::V20) {
+                    value = "/std:c++20";
+                } else if (option == Version::V23) {
+                    value = "/std:c++latest";
+                }
+            }
+
+            return value;
+        }
+
+        std::set<Targets> getTargets() {
+            if (options.targets.empty()) {
+                return std::set<Targets>{options.target};
+            }
+
+            return options.targets;
+        }
+
+        Targets getHostTarget() {
+            if (os == "windows") {
+                return Targets::Windows;
+            } else if (os == "macos") {
+                return Targets::MacOS;
+            }
+
+            return Targets::Linux;
+        }
+
+        std::string getTargetName(Targets target) {
+            if (target == Targets::Windows) {
+                return "windows";
+            } else if (target == Targets::MacOS) {
+                return "macos";
+            }
+
+            return "linux";
+        }
+
+        std::string getCompilerForTarget(Targets target) {
+            if (target == getHostTarget()) {
+                return Toolchain::get().getCompiler();
+            }
+
+            if (os == "linux") {
+                if (target == Targets::Windows) {
+                    return "x86_64-w64-mingw32-g++";
+                }
+            }
+
+            return "";
+        }
+
+        // CC for the host target, otherwise the C driver that matches the
+        // C++ one. cl compiles .c files as C by itself.
+        std::string getCCompilerForTarget(Targets target) {
+            const char *cc = std::getenv("CC");
+            if (target == getHostTarget() && cc != nullptr
+                && std::string(cc) != "") {
+                return cc;
+            }
+
+            std::string compiler = getCompilerForTarget(target);
+            std::vector<std::pair<std::string, std::string>> drivers = {
+                {"clang++", "clang"}, {"g++", "gcc"}, {"c++", "cc"},
+            };
+            for (auto &[cxx, c] : drivers) {
+                size_t at = compiler.rfind(cxx);
+                if (at != std::string::npos) {
+                    return compiler.replace(at, cxx.size(), c);
+                }
+            }
+
+            return compiler;
+        }
+
+        std::string getCompilerIdentity(Targets target) {
+            return Toolchain::get(getCompilerForTarget(target)).getIdentity();
+        }
+
+        unsigned int getJobCount() {
+            if (Jobserver::get().getSlots() > 0) {
+                return Jobserver::get().getSlots();
+            }
+
+            unsigned int jobs = std::thread::hardware_concurrency();
+            return jobs == 0 ? 1 : jobs;
+        }
+
+        std::string getOutputName(Targets target) {
+            std::string name = options.name;
+            if (target == Targets::Windows && !name.ends_with(".exe")) {
+                name += ".exe";
+            }
+
+            return name;
+        }
+
+        // outputs inside the target's build directory (test binaries) keep
+        // their path there so maps of same-named outputs do not collide
+        std::string getMapPath(Targets target, std::string output) {
+            std::filesystem::path target_dir = std::filesystem::path(build_dir)
+                / getTargetName(target);
+            std::filesystem::path rel = std::filesystem::path(output)
+                .lexically_normal().lexically_relative(target_dir);
+            if (rel.empty() || *rel.begin() == "..") {
+                rel = std::filesystem::path(output).filename();
+            }
+
+            return (target_dir / rel).string() + ".map";
+        }
+
+        // the added sources without the root source file or tests, which a
+        // glob may have picked up and which have a main of their own
+        std::vector<std::string> getSourceFiles() {
+            std::set<std::string> skip;
+            skip.insert(normalizeSourcePath(options.root_source_file));
+            for (auto test_file : test_files) {
+                skip.insert(normalizeSourcePath(test_file));
+            }
+
+            std::vector<std::string> sources;
+            for (auto source_file : source_files) {
+                if (skip.count(normalizeSourcePath(source_file)) == 0) {
+                    sources.push_back(source_file);
+                }
+            }
+
+            return sources;
+        }
+
+        std::string normalizeSourcePath(std::string source_file) {
+            return std::filesystem::path(source_file).lexically_normal()
+                .generic_string();
+        }
+
+        std::string getObjectPath(Targets target, std::string source_file) {
+            std::filesystem::path src = std::filesystem::path(
+                cleanUpSubDir(source_file)
+            ).lexically_normal();
+
+            std::string rel = "";
+            for (auto part : src.relative_path()) {
+                if (part == "..") {
+                    rel += "__/";
+                } else {
+                    rel += part.string() + "/";
+                }
+            }
+            rel.pop_back();
+
+            std::string ext = os == "windows" ? ".obj" : ".o";
+            std::filesystem::path obj = std::filesystem::path(build_dir)
+                / getTargetName(target) / (rel + ext);
+
+            return obj.string();
+        }
+
+        bool hasDebugG() {
+            return std::find(options.debug.begin(), options.debug.end(),
+                             Debug::G) != options.debug.end();
+        }
+
+        bool isSplitDwarf() {
+            return hasDebugG() && os != "windows"
+                && options.debug_info != DebugInfo::Full;
+        }
+
+        // split dwarf keeps the bulk of the debug info in .dwo files beside
+        // the objects so the linker does not copy it, -gz compresses what
+        // is left in the objects and the output
+        std::string getDebugInfoFlags() {
+            std::string flags = "";
+            if (!hasDebugG() || os == "windows") {
+                return flags;
+            }
+
+            if (isSplitDwarf()) {
+                flags += " -gsplit-dwarf";
+            }
+            if (options.debug_compression == DebugCompression::Zlib) {
+                flags += " -gz=zlib";
+            } else if (options.debug_compression == DebugCompression::Zstd) {
+                flags += Toolchain::get().supports("-gz=zstd")
+                    ? " -gz=zstd" : " -gz=zlib";
+            }
+
+            return flags;
+        }
+
+        // packs the .dwo files of every object into <output>.dwp
+        std::string addDwpCommand(
+            std::string command,
+            std::string output,
+            std::vector<std::string> objects
+        ) {
+            if (!isSplitDwarf() || options.debug_info != DebugInfo::SplitPacked) {
+                return command;
+            }
+
+            command += " && dwp -o " + output + ".dwp";
+            for (auto obj : objects) {
+                command += " " + getDwoPath(obj);
+            }
+
+            return command;
+        }
+
+        std::string getDwoPath(std::string object_file) {
+            std::filesystem::path dwo = object_file;
+            dwo.replace_extension(".dwo");
+
+            return dwo.string();
+        }
+
+        void addBytesWritten(std::atomic<uint64_t> &counter, std::string path) {
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(path, ec);
+            if (!ec) {
+                counter += size;
+            }
+        }
+
+        void addObjectBytesWritten(std::string object_file) {
+            addBytesWritten(bytes_objects, object_file);
+            if (isSplitDwarf()) {
+                addBytesWritten(bytes_debug, getDwoPath(object_file));
+            }
+        }
+
+        // C sources from vendored libraries get a C standard instead of the
+        // project's C++ one
+        std::string getCodegenFlags(Targets target, bool c_source = false) {
+            std::string flags = "";
+            for (auto d : getDebugStringList(options.debug)) {
+                if (d != "") {
+                    flags += " " + d;
+                }
+            }
+            flags += " " + getOptimizeString(options.optimize);
+            if (!c_source) {
+                flags += " " + getVersionString(options.version);
+            } else {
+                flags += os == "windows" ? " /std:c17" : " -std=c17";
+            }
+            if (options.lto && os != "windows") {
+                flags += " -flto";
+            }
+            if (isComponentBuild(target)) {
+                flags += " -fPIC -fvisibility=default";
+            }
+            if (profile) {
+                flags += " -fno-omit-frame-pointer";
+            }
+            if (options.gc_sections || options.icf) {
+                flags += os == "windows"
+                    ? " /Gy"
+                    : " -ffunction-sections -fdata-sections";
+            }
+
+            return flags;
+        }
+
+        // ~/.config/.cppc is always on the include path so instrument.h
+        // can stay included when instrumentation is off
+        std::string getSourceFlags(Targets target) {
+            std::string flags = "";
+            std::string cppc_dir = getHomePath() + "/.config/.cppc";
+            if (os == "windows") {
+                flags += " /I\"" + cppc_dir + "\"";
+                if (instrumentation) {
+                    flags += " /DCPPC_INSTRUMENT";
+                }
+            } else {
+                flags += " -I" + cppc_dir;
+                if (instrumentation) {
+                    flags += " -DCPPC_INSTRUMENT";
+                }
+            }
+            for (auto dir : include_dirs) {
+                flags += " " + dir;
+            }
+            for (auto flag : dep_compile_flags[target]) {
+                flags += " " + flag;
+            }
+            for (auto libd : lib_dirs) {
+                flags += " " + libd;
+            }
+
+            return flags;
+        }
+
+        std::string getCompileCommand(
+            Targets target,
+            std::string source_file,
+            std::string object_file
+        ) {
+            std::string command = getCompilerForTarget(target);
+
+            if (os == "windows") {
+                command += " /nologo /c /EHsc";
+            } else {
+                command += " -c";
+            }
+            command += getCodegenFlags(target) + getDebugInfoFlags()
+                + getSourceFlags(target) + getReproducibleFlags(source_file);
+
+            if (os == "windows") {
+                command += " " + cleanUpSubDir(source_file)
+                    + " /Fo" + object_file;
+            } else {
+                command += " -MMD -MP " + source_file + " -o " + object_file;
+            }
+
+            return command;
+        }
+
+        std::string getPreprocessCommand(
+            Targets target,
+            std::string source_file,
+            std::string object_file,
+            std::string output_file
+        ) {
+            std::filesystem::path dep_file = object_file;
+            dep_file.replace_extension(".d");
+
+            return getCompilerForTarget(target) + " -E"
+                + getCodegenFlags(target) + getSourceFlags(target)
+                + getReproducibleFlags(source_file)
+                + " -MMD -MP -MF " + dep_file.string() + " -MT " + object_file
+                + " " + source_file + " -o " + output_file;
+        }
+
+        // reproducible builds map the checkout and the cppc install
+        // directory to fixed names so objects do not depend on where they
+        // were built
+        std::string getReproducibleFlags(std::string source_file) {
+            if (!options.reproducible || os == "windows") {
+                return "";
+            }
+
+            return " -ffile-prefix-map=" + getProjectPath() + "=."
+                + " -ffile-prefix-map=" + getHomePath() + "/.config/.cppc=.cppc"
+                + " -frandom-seed=" + cleanUpSubDir(source_file);
+        }
+
+        // replaces the absolute paths of this checkout and machine so cache
+        // keys match between checkouts
+        std::string normalizePaths(std::string text) {
+            std::vector<std::pair<std::string, std::string>> paths = {
+                {getProjectPath(), "."},
+                {getHomePath() + "/.config/.cppc", ".cppc"},
+            };
+            if (paths[0].first.size() < paths[1].first.size()) {
+                std::swap(paths[0], paths[1]);
+            }
+
+            for (auto &[from, to] : paths) {
+                size_t at = 0;
+                while ((at = text.find(from, at)) != std::string::npos) {
+                    text.replace(at, from.size(), to);
+                    at += to.size();
+                }
+            }
+
+            return text;
+        }
+
+        void setSourceDateEpoch() {
+            if (std::getenv("SOURCE_DATE_EPOCH") != nullptr) {
+                return;
+            }
+
+            std::string epoch = readCommand("git log -1 --format=%ct 2>"
+                + std::string(os == "windows" ? "NUL" : "/dev/null"));
+            epoch = epoch.substr(0, epoch.find_first_of("\r\n"));
+            if (epoch == "") {
+                epoch = "0";
+            }
+#ifdef _WIN32
+            _putenv_s("SOURCE_DATE_EPOCH", epoch.c_str());
+#else
+            setenv("SOURCE_DATE_EPOCH", epoch.c_str(), 1);
+#endif
+        }
+
+        std::string getCacheDir() {
+            const char *dir = std::getenv("CPPC_CACHE_DIR");
+            if (dir != nullptr && std::string(dir) != "") {
+                return dir;
+            }
+
+            return getHomePath() + "/.config/.cppc/cache";
+        }
+
+        // Plain builds just run the compile command. Reproducible builds
+        // preprocess first and look the object up in the cache, keyed by the
+        // path-normalized command and preprocessed source. Remote workers
+        // compile the preprocessed source. A job no worker could run is
+        // retried with the local compile command, a compile error from a
+        // worker fails the job like a local one.
+        int compileObject(
+            Targets target,
+            std::string source_file,
+            std::string object_file,
+            std::string command
+        ) {
+            // the cache and the workers only hand back the object, not the
+            // .dwo written beside it
+            bool use_cache = options.reproducible && os != "windows"
+                && !isSplitDwarf();
+            bool use_remote = remote.size() > 0 && os != "windows"
+                && !isSplitDwarf();
+            if (!use_cache && !use_remote) {
+                return std::system(command.c_str());
+            }
+
+            std::string preprocessed = object_file + ".ii";
+            std::string preprocess = getPreprocessCommand(
+                target, source_file, object_file, preprocessed
+            );
+            int status = std::system(preprocess.c_str());
+            if (status != 0) {
+                return status;
+            }
+
+            std::filesystem::path cached = "";
+            std::error_code ec;
+            if (use_cache) {
+                uint64_t key = hashString(normalizePaths(command));
+                key = hashString(getCompilerIdentity(target), key);
+                key = hashString(
+                    normalizePaths(RemoteSocket::readFile(preprocessed)), key
+                );
+                std::string hex = hashToHex(key);
+                cached = std::filesystem::path(getCacheDir())
+                    / hex.substr(0, 2) / (hex + ".o");
+
+                if (std::filesystem::exists(cached)) {
+                    std::filesystem::remove(preprocessed, ec);
+                    std::filesystem::copy_file(
+                        cached, object_file,
+                        std::filesystem::copy_options::overwrite_existing, ec
+                    );
+                    if (!ec) {
+                        return 0;
+                    }
+                }
+            }
+
+            status = -1;
+            if (use_remote) {
+                // the flags of getCompileCommand() minus the source flags
+                // the preprocessor already applied, so a worker builds the
+                // object the cache key above describes
+                std::vector<std::string> args;
+                std::istringstream flags(
+                    getCodegenFlags(target) + getDebugInfoFlags()
+                        + getReproducibleFlags(source_file)
+                );
+                std::string flag;
+                while (flags >> flag) {
+                    args.push_back(flag);
+                }
+
+                std::string compiler = getCompilerForTarget(target);
+                std::string diagnostics;
+                status = remote.compile(
+                    compiler, Toolchain::get(compiler).getVersion(), args,
+                    preprocessed, object_file, diagnostics
+                );
+                std::cerr << diagnostics;
+            }
+            std::filesystem::remove(preprocessed, ec);
+
+            if (status < 0) {
+                status = std::system(command.c_str());
+            }
+
+            // copy then rename so readers never see half an object
+            if (status == 0 && use_cache) {
+                std::filesystem::create_directories(cached.parent_path(), ec);
+                std::filesystem::path tmp = cached;
+                tmp += ".tmp-" + getTempSuffix();
+                std::filesystem::copy_file(
+                    object_file, tmp,
+                    std::filesystem::copy_options::overwrite_existing, ec
+                );
+                if (!ec) {
+                    std::filesystem::rename(tmp, cached, ec);
+                }
+            }
+
+            return status;
+        }
+
+        std::string getLinkCommand(
+            Targets target,
+            std::vector<std::string> objects,
+            std::string output,
+            bool strip_unused,
+            std::vector<std::string> extra_flags = {}
+        ) {
+            std::string command = getCompilerForTarget(target);
+            if (options.reproducible) {
+                std::sort(objects.begin(), objects.end());
+            }
+
+            if (os == "windows") {
+                command += " /nologo";
+            } else {
+                for (auto d : getDebugStringList(options.debug)) {
+                    command += " " + d;
+                }
+                command += " " + getOptimizeString(options.optimize);
+                if (options.lto) {
+                    command += " -flto=jobserver";
+                }
+                command += getDebugInfoFlags();
+                if (strip_unused && options.icf) {
+                    command += " -fuse-ld=gold -Wl,--icf=all";
+                }
+                if (strip_unused && options.gc_sections) {
+                    command += " -Wl,--gc-sections";
+                }
+                command += " -Wl,-Map=" + getMapPath(target, output);
+            }
+            for (auto obj : objects) {
+                command += " " + obj;
+            }
+
+            if (os == "windows") {
+                command += " /Fe" + output;
+            } else {
+                command += " -o " + output;
+            }
+            for (auto libd : lib_dirs) {
+                command += " " + libd;
+            }
+            for (auto flag : dep_link_flags[target]) {
+                command += " " + flag;
+            }
+            for (auto lib : libs) {
+                command += " " + lib;
+            }
+            for (auto flag : extra_flags) {
+                command += " " + flag;
+            }
+            if (os == "windows" && strip_unused) {
+                if (options.gc_sections && options.icf) {
+                    command += " /link /OPT:REF,ICF";
+                } else if (options.gc_sections) {
+                    command += " /link /OPT:REF";
+                } else if (options.icf) {
+                    command += " /link /OPT:ICF";
+                }
+            }
+
+            return command;
+        }
+
+        // queues whatever is out of date. In a component build every source
+        // directory becomes its own shared library and the executable only
+        // relinks when its own objects or the set of libraries change.
+        void addLinkJobs(JobPool &pool, Targets target, TargetBuild &tb) {
+            std::string output = getOutputName(target);
+            std::string stamp = getLinkStampPath(target);
+
+            if (!isComponentBuild(target)) {
+                std::string command = addDwpCommand(getLinkCommand(
+                    target, tb.objects, output, true
+                ), output, tb.objects);
+                if (!isLinkUpToDate(output, stamp, command, tb.objects)) {
+                    addLinkJob(pool, tb, command, stamp, output, nullptr);
+                }
+                return;
+            }
+
+            std::vector<std::string> exe_objects = {tb.objects[0]};
+            std::vector<std::string> component_libs;
+            std::vector<std::pair<std::string, std::string>> stale;
+            for (auto &[name, objects] : getComponents(target, tb.objects)) {
+                std::string lib = getComponentPath(target, name);
+                std::string command = getComponentLinkCommand(
+                    target, objects, lib
+                );
+                component_libs.push_back(lib);
+                if (!isLinkUpToDate(lib, lib, command, objects)) {
+                    stale.push_back({lib, command});
+                }
+            }
+
+            std::string lib_dir = std::filesystem::path(
+                getComponentPath(target, "")
+            ).parent_path().string();
+            component_libs.push_back("-Wl,-rpath,'$ORIGIN/" + lib_dir + "'");
+            std::string command = addDwpCommand(getLinkCommand(
+                target, exe_objects, output, true, component_libs
+            ), output, tb.objects);
+
+            std::function<void()> link_exe = [this, &pool, &tb, output,
+                                              stamp, command, exe_objects]() {
+                if (!tb.link_failed
+                    && !isLinkUpToDate(output, stamp, command, exe_objects)) {
+                    addLinkJob(pool, tb, command, stamp, output, nullptr);
+                }
+            };
+
+            tb.links_remaining = stale.size();
+            if (stale.size() == 0) {
+                link_exe();
+                return;
+            }
+
+            std::filesystem::create_directories(lib_dir);
+            for (auto &[lib, lib_command] : stale) {
+                addLinkJob(pool, tb, lib_command, lib, lib, [&tb, link_exe]() {
+                    if (--tb.links_remaining == 0) {
+                        link_exe();
+                    }
+                });
+            }
+        }
+
+        void addLinkJob(
+            JobPool &pool,
+            TargetBuild &tb,
+            std::string command,
+            std::string stamp,
+            std::string output,
+            std::function<void()> done
+        ) {
+            pool.add([this, command, stamp, output, done, &tb]() {
+                int status = std::system(command.c_str());
+                if (status == 0) {
+                    writeCommandStamp(stamp, command);
+                    addBytesWritten(bytes_outputs, output);
+                    if (isSplitDwarf()) {
+                        addBytesWritten(bytes_debug, output + ".dwp");
+                    }
+                } else {
+                    tb.link_failed = true;
+                }
+                if (done) {
+                    done();
+                }
+                return status;
+            });
+        }
+
+        bool isComponentBuild(Targets target) {
+            return component_build && os == "linux"
+                && target == Targets::Linux
+                && options.optimize == Optimize::Debug;
+        }
+
+        // groups every object except the root source's by its directory
+        std::map<std::string, std::vector<std::string>> getComponents(
+            Targets target,
+            std::vector<std::string> objects
+        ) {
+            std::map<std::string, std::vector<std::string>> components;
+            std::filesystem::path base = std::filesystem::path(build_dir)
+                / getTargetName(target);
+
+            for (size_t i = 1; i < objects.size(); i++) {
+                std::string dir = std::filesystem::path(objects[i])
+                    .parent_path().lexically_relative(base).generic_string();
+                std::string name = dir == "." || dir == "" ? "root" : dir;
+                std::replace(name.begin(), name.end(), '/', '_');
+                std::replace(name.begin(), name.end(), '.', '_');
+                components[name].push_back(objects[i]);
+            }
+
+            return components;
+        }
+
+        std::string getComponentPath(Targets target, std::string name) {
+            std::filesystem::path lib = std::filesystem::path(build_dir)
+                / getTargetName(target) / "lib"
+                / ("lib" + options.name + "_" + name + ".so");
+
+            return lib.string();
+        }
+
+        std::string getComponentLinkCommand(
+            Targets target,
+            std::vector<std::string> objects,
+            std::string output
+        ) {
+            std::string command = getCompilerForTarget(target) + " -shared"
+                + " -Wl,-soname," + std::filesystem::path(output)
+                    .filename().string();
+            for (auto d : getDebugStringList(options.debug)) {
+                command += " " + d;
+            }
+            for (auto obj : objects) {
+                command += " " + obj;
+            }
+            command += " -o " + output;
+            for (auto libd : lib_dirs) {
+                command += " " + libd;
+            }
+            for (auto flag : dep_link_flags[target]) {
+                command += " " + flag;
+            }
+            for (auto lib : libs) {
+                command += " " + lib;
+            }
+
+            return command;
+        }
+
+        std::string getLinkStampPath(Targets target) {
+            std::filesystem::path stamp = std::filesystem::path(build_dir)
+                / getTargetName(target) / (options.name + ".link");
+
+            return stamp.string();
+        }
+
+        // an object is fresh when it was built by the same command and is
+        // newer than its source and every header listed in its depfile
+        bool isObjectUpToDate(
+            std::string source_file,
+            std::string object_file,
+            std::string command
+        ) {
+            std::error_code ec;
+            auto obj_time = std::filesystem::last_write_time(object_file, ec);
+            if (ec) {
+                return false;
+            }
+
+            std::ifstream stamp(object_file + ".cmd");
+            std::string previous;
+            std::getline(stamp, previous);
+            if (previous != command) {
+                return false;
+            }
+
+            std::vector<std::string> deps = readDepFile(object_file);
+            deps.push_back(source_file);
+            for (auto dep : deps) {
+                auto dep_time = std::filesystem::last_write_time(dep, ec);
+                if (ec || dep_time > obj_time) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool isLinkUpToDate(
+            std::string output,
+            std::string stamp_path,
+            std::string command,
+            std::vector<std::string> inputs
+        ) {
+            std::error_code ec;
+            auto out_time = std::filesystem::last_write_time(output, ec);
+            if (ec) {
+                return false;
+            }
+
+            std::ifstream stamp(stamp_path + ".cmd");
+            std::string previous;
+            std::getline(stamp, previous);
+            if (previous != command) {
+                return false;
+            }
+
+            for (auto input : inputs) {
+                auto in_time = std::filesystem::last_write_time(input, ec);
+                if (ec || in_time > out_time) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        void writeCommandStamp(std::string object_file, std::string command) {
+            std::ofstream stamp(object_file + ".cmd", std::ios::out);
+            stamp << command << std::endl;
+        }
+
+        std::vector<std::string> readDepFile(std::string object_file) {
+            std::vector<std::string> deps;
+            std::filesystem::path dep_path = object_file;
+            dep_path.replace_extension(".d");
+
+            std::ifstream file(dep_path);
+            if (!file.is_open()) {
+                return deps;
+            }
+
+            // only the first rule matters, -MP phony targets follow it
+            std::string line;
+            std::string rule = "";
+            while (std::getline(file, line)) {
+                if (line.ends_with("\\")) {
+                    rule += line.substr(0, line.size() - 1) + " ";
+                } else {
+                    rule += line;
+                    break;
+                }
+            }
+
+            std::istringstream words(rule);
+            std::string word;
+            bool past_target = false;
+            while (words >> word) {
+                if (!past_target) {
+                    past_target = word.ends_with(":");
+                    continue;
+                }
+                deps.push_back(word);
+            }
+
+            return deps;
+        }
+
+        bool prepareVendoredDependencies(Targets target) {
+            dep_compile_flags[target].clear();
+            dep_link_flags[target].clear();
+
+            for (auto &[path, recipe] : vendored_deps) {
+                if (!std::filesystem::is_directory(path)) {
+                    std::cerr << "Error: vendored dependency " << path
+                              << " does not exist" << std::endl;
+                    return false;
+                }
+
+                uint64_t key = hashString(getSourceHash(path, recipe.name));
+                key = hashString(getCompilerForTarget(target), key);
+                key = hashString(getCompilerIdentity(target), key);
+                key = hashString(getCodegenFlags(target), key);
+                key = hashString(getCCompilerForTarget(target), key);
+                key = hashString(recipe.command, key);
+                std::filesystem::path store = std::filesystem::path(getHomePath())
+                    / ".config" / ".cppc" / "store"
+                    / (recipe.name + "-" + hashToHex(key));
+
+                if (!std::filesystem::exists(store)
+                    && !buildVendoredDependency(target, path, recipe, store)) {
+                    std::cerr << "Error: could not build vendored dependency "
+                              << recipe.name << std::endl;
+                    return false;
+                }
+
+                for (auto dir : recipe.include_dirs) {
+                    dep_compile_flags[target].push_back(
+                        "-I" + (std::filesystem::path(path) / dir).string()
+                    );
+                }
+                if (std::filesystem::exists(store / "include")) {
+                    dep_compile_flags[target].push_back(
+                        "-I" + (store / "include").string()
+                    );
+                }
+                if (os == "windows") {
+                    dep_link_flags[target].push_back(
+                        (store / "lib" / (recipe.name + ".lib")).string()
+                    );
+                } else {
+                    dep_link_flags[target].push_back(
+                        "-L" + (store / "lib").string()
+                    );
+                    dep_link_flags[target].push_back("-l" + recipe.name);
+                }
+            }
+
+            return true;
+        }
+
+        // hashes the files under the dependency except version control
+        // directories and what its recipe command wrote into the tree, so
+        // in-tree builds and other checkouts of the same source keep the
+        // same hash. The hash is remembered in a stamp named after a
+        // fingerprint of paths, sizes and mtimes so unchanged trees are not
+        // read again on every build.
+        std::string getSourceHash(std::string path, std::string name) {
+            std::set<std::string> outputs = readVendoredOutputs(name);
+            std::vector<std::filesystem::path> files;
+            for (auto &f : listDependencyFiles(path)) {
+                std::string rel = std::filesystem::relative(f, path)
+                    .generic_string();
+                if (outputs.count(rel) == 0) {
+                    files.push_back(f);
+                }
+            }
+
+            uint64_t fingerprint = hashString(path);
+            for (auto &f : files) {
+                fingerprint = hashString(f.generic_string(), fingerprint);
+                fingerprint = hashString(
+                    std::to_string(std::filesystem::file_size(f)), fingerprint
+                );
+                fingerprint = hashString(std::to_string(
+                    std::filesystem::last_write_time(f)
+                        .time_since_epoch().count()
+                ), fingerprint);
+            }
+
+            std::filesystem::path stamp_dir = std::filesystem::path(build_dir)
+                / "vendor";
+            std::filesystem::path stamp_path = stamp_dir
+                / (name + "-" + hashToHex(fingerprint) + ".hash");
+            std::ifstream stamp(stamp_path);
+            std::string cached_hash;
+            if (stamp >> cached_hash) {
+                return cached_hash;
+            }
+
+            uint64_t hash = hashString("");
+            for (auto &f : files) {
+                std::ifstream file(f, std::ios::binary);
+                std::string content(
+                    (std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>()
+                );
+                hash = hashString(
+                    std::filesystem::relative(f, path).generic_string(), hash
+                );
+                hash = hashString(content, hash);
+            }
+
+            // stamps of earlier versions of this dependency are stale
+            std::error_code ec;
+            std::filesystem::create_directories(stamp_dir, ec);
+            for (auto &entry :
+                 std::filesystem::directory_iterator(stamp_dir, ec)) {
+                std::string file_name = entry.path().filename().string();
+                if (file_name.size() == name.size() + 22
+                    && file_name.starts_with(name + "-")
+                    && file_name.ends_with(".hash")) {
+                    std::filesystem::remove(entry.path(), ec);
+                }
+            }
+            std::ofstream out(stamp_path, std::ios::out);
+            out << hashToHex(hash) << std::endl;
+
+            return hashToHex(hash);
+        }
+
+        // every file under a dependency outside .git, .hg and .svn, sorted
+        std::vector<std::filesystem::path> listDependencyFiles(
+            std::string path
+        ) {
+            std::vector<std::filesystem::path> files;
+            std::error_code ec;
+            auto it = std::filesystem::recursive_directory_iterator(path, ec);
+            for (; !ec && it != std::filesystem::end(it); it.increment(ec)) {
+                std::string file_name = it->path().filename().string();
+                if (file_name == ".git" || file_name == ".hg"
+                    || file_name == ".svn") {
+                    it.disable_recursion_pending();
+                } else if (it->is_regular_file()) {
+                    files.push_back(it->path());
+                }
+            }
+            std::sort(files.begin(), files.end());
+
+            return files;
+        }
+
+        std::map<std::string, std::string> getDependencyFileTimes(
+            std::string path
+        ) {
+            std::map<std::string, std::string> times;
+            std::error_code ec;
+            for (auto &f : listDependencyFiles(path)) {
+                auto time = std::filesystem::last_write_time(f, ec);
+                times[std::filesystem::relative(f, path).generic_string()] =
+                    std::to_string(time.time_since_epoch().count());
+            }
+
+            return times;
+        }
+
+        // the files recipe commands of this dependency wrote into its tree,
+        // one relative path per line
+        std::set<std::string> readVendoredOutputs(std::string name) {
+            std::set<std::string> outputs;
+            std::ifstream file(std::filesystem::path(build_dir) / "vendor"
+                               / (name + ".outputs"));
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line != "") {
+                    outputs.insert(line);
+                }
+            }
+
+            return outputs;
+        }
+
+        // files that are new or changed since <before> were written by the
+        // recipe command, they are added to the ones already recorded
+        void writeVendoredOutputs(
+            std::string path,
+            std::string name,
+            std::map<std::string, std::string> before
+        ) {
+            std::set<std::string> outputs = readVendoredOutputs(name);
+            for (auto &[file, time] : getDependencyFileTimes(path)) {
+                auto found = before.find(file);
+                if (found == before.end() || found->second != time) {
+                    outputs.insert(file);
+                }
+            }
+
+            std::filesystem::path out_path = std::filesystem::path(build_dir)
+                / "vendor" / (name + ".outputs");
+            std::error_code ec;
+            std::filesystem::create_directories(out_path.parent_path(), ec);
+            std::ofstream out(out_path, std::ios::out);
+            for (auto &file : outputs) {
+                out << file << "\n";
+            }
         }
 
-        std::string getVersionString(Version option) {
-            std::string value = "";
-            if (os == "linux") {
-                if (option == Version::V11) {
-                    value = "-std=c++11";
-                } else if (option == Version::V14) {
-                    value = "-std=c++14";
-                } else if (option == Version::V17) {
-                    value = "-std=c++17";
-                } else if (option == Version::V20) {
-                    value = "-std=c++20";
-                } else if (option == Version::V23) {
-                    value = "-std=c++23";
+        // builds into a temporary directory and renames it into place, so
+        // a store entry either is complete or does not exist
+        bool buildVendoredDependency(
+            Targets target,
+            std::string path,
+            Recipe recipe,
+            std::filesystem::path store
+        ) {
+            // a build that crashed may have left the same name behind
+            std::error_code ec;
+            std::filesystem::path tmp = store;
+            tmp += ".tmp-" + getTempSuffix();
+            std::filesystem::remove_all(tmp, ec);
+            std::filesystem::create_directories(tmp / "lib");
+            std::string prefix = std::filesystem::absolute(tmp).string();
+
+            std::cout << "Building vendored dependency " << recipe.name
+                      << std::endl;
+
+            bool ok = true;
+            if (recipe.command != "") {
+                std::string command = "cd " + path
+                    + " && export CPPC_PREFIX=\"" + prefix + "\""
+                    + " CXX=\"" + getCompilerForTarget(target) + "\""
+                    + " CXXFLAGS=\"" + getCodegenFlags(target) + "\""
+                    + " CC=\"" + getCCompilerForTarget(target) + "\""
+                    + " CFLAGS=\"" + getCodegenFlags(target, true) + "\" && "
+                    + recipe.command;
+                std::map<std::string, std::string> before =
+                    getDependencyFileTimes(path);
+                ok = std::system(command.c_str()) == 0;
+                writeVendoredOutputs(path, recipe.name, before);
+            } else {
+                ok = buildVendoredSources(target, path, recipe, tmp);
+            }
+
+            if (ok) {
+                std::filesystem::rename(tmp, store, ec);
+            }
+            std::filesystem::remove_all(tmp, ec);
+
+            return ok && std::filesystem::exists(store);
+        }
+
+        bool buildVendoredSources(
+            Targets target,
+            std::string path,
+            Recipe recipe,
+            std::filesystem::path out
+        ) {
+            std::string includes = "";
+            for (auto dir : recipe.include_dirs) {
+                includes += " -I" + (std::filesystem::path(path) / dir).string();
+            }
+
+            JobPool pool(getJobCount());
+            std::vector<std::string> objects;
+            for (auto dir : recipe.source_dirs) {
+                std::filesystem::path src_dir = std::filesystem::path(path) / dir;
+                if (!std::filesystem::is_directory(src_dir)) {
+                    continue;
                 }
-            } else if (os == "windows") {
-                if (option == Version::V11) {
-                    value = "/std:c++11";
-                } else if (option == Version::V14) {
-                    value = "/std:c++14";
-                } else if (option == Version::V17) {
-                    value = "/std:c++17";
-                } else if (option == Version::V20) {
-                    value = "/std:c++20";
-                } else if (option == Version::V23) {
-                    value = "/std:c++latest";
+
+                for (auto &entry :
+                     std::filesystem::recursive_directory_iterator(src_dir)) {
+                    std::string ext = entry.path().extension().string();
+                    if (ext != ".cpp" && ext != ".cc" && ext != ".cxx"
+                        && ext != ".c") {
+                        continue;
+                    }
+
+                    std::string rel = std::filesystem::relative(
+                        entry.path(), path
+                    ).generic_string();
+                    std::filesystem::path obj = out / "obj"
+                        / (rel + (os == "windows" ? ".obj" : ".o"));
+                    std::filesystem::create_directories(obj.parent_path());
+                    objects.push_back(obj.string());
+
+                    bool c_source = ext == ".c";
+                    std::string command = c_source
+                        ? getCCompilerForTarget(target)
+                        : getCompilerForTarget(target);
+                    std::string flags = getCodegenFlags(target, c_source);
+                    if (os == "windows") {
+                        command += " /nologo /c /EHsc" + flags + includes + " "
+                            + entry.path().string() + " /Fo" + obj.string();
+                    } else {
+                        command += " -c" + flags + includes + " "
+                            + entry.path().string() + " -o " + obj.string();
+                    }
+                    pool.addCommand(command);
                 }
             }
 
-            return value;
+            for (int status : pool.run()) {
+                if (status != 0) {
+                    return false;
+                }
+            }
+
+            std::sort(objects.begin(), objects.end());
+            std::string archive = "";
+            if (os == "windows") {
+                archive = "lib /nologo /OUT:"
+                    + (out / "lib" / (recipe.name + ".lib")).string();
+            } else if (target == Targets::Windows) {
+                archive = "x86_64-w64-mingw32-ar rcsD "
+                    + (out / "lib" / ("lib" + recipe.name + ".a")).string();
+            } else {
+                archive = "ar rcsD "
+                    + (out / "lib" / ("lib" + recipe.name + ".a")).string();
+            }
+            for (auto obj : objects) {
+                archive += " " + obj;
+            }
+
+            bool ok = std::system(archive.c_str()) == 0;
+            std::error_code ec;
+            std::filesystem::remove_all(out / "obj", ec);
+
+            return ok;
         }
 
-        std::string getCompileCommand() {
-            std::string debug_string = "";
-            for (Debug d : options.debug) {
-                if (os == "linux") {
-                    if (d == Debug::G) {
-                        debug_string += " -g ";
-                    } else if (d == Debug::Wall) {
-                        debug_string += " -Wall ";
-                    } else if (d == Debug::Wextra) {
-                        debug_string += " -Wextra ";
-                    } else if (d == Debug::Pedantic) {
-                        debug_string += " -pedantic ";
+        void reportBytesWritten() {
+            uint64_t total = bytes_objects + bytes_debug + bytes_outputs;
+            if (total == 0) {
+                return;
+            }
+
+            std::cout << "Wrote " << total << " bytes: " << bytes_objects
+                      << " objects, " << bytes_debug << " split debug info, "
+                      << bytes_outputs << " linked outputs" << std::endl;
+        }
+
+        // cppc test [--affected] [--since <git ref>] [--explain]
+        // --affected keeps the tests whose sources or headers (from the
+        // depfiles of the last build) changed since the test last passed, or
+        // since <git ref> when --since is given
+        void runTests() {
+            if (test_files.empty()) {
+                std::cout << "No tests, add them with builder.addTest()"
+                          << std::endl;
+                return;
+            }
+
+            Targets target = getHostTarget();
+            bool affected_only = hasArg("--affected") || getArg("--since") != "";
+            bool explain = hasArg("--explain");
+            std::string since = getArg("--since");
+
+            if (!prepareVendoredDependencies(target)) {
+                std::exit(1);
+            }
+
+            std::vector<std::string> lib_sources = getSourceFiles();
+            std::sort(lib_sources.begin(), lib_sources.end());
+
+            std::set<std::string> changed;
+            if (since != "") {
+                changed = getGitChanges(since);
+            }
+
+            std::vector<TestRun> tests;
+            for (auto test_file : test_files) {
+                TestRun run;
+                run.sources = lib_sources;
+                run.sources.insert(run.sources.begin(), test_file);
+                for (auto src : run.sources) {
+                    run.objects.push_back(getObjectPath(target, src));
+                }
+                // named after the whole path like the objects, so tests with
+                // the same file name in different directories do not share a
+                // binary or a .pass stamp
+                std::filesystem::path rel = std::filesystem::path(
+                    cleanUpSubDir(test_file)
+                ).lexically_normal().replace_extension();
+                std::filesystem::path bin = std::filesystem::path(build_dir)
+                    / getTargetName(target) / "tests" / "bin";
+                for (auto part : rel.relative_path()) {
+                    bin /= part == ".." ? std::filesystem::path("__") : part;
+                }
+                run.name = rel.generic_string();
+                run.binary = bin.string();
+                if (target == Targets::Windows) {
+                    run.binary += ".exe";
+                }
+                run.link_command = getLinkCommand(
+                    target, run.objects, run.binary, false
+                );
+
+                if (affected_only && since != "") {
+                    run.reasons = getChangedReasons(run, changed, since);
+                } else if (affected_only) {
+                    run.reasons = getStaleReasons(target, run);
+                }
+                run.selected = !affected_only || !run.reasons.empty();
+
+                if (explain) {
+                    std::cout << (run.selected ? "run  " : "skip ")
+                              << run.name << std::endl;
+                    for (auto reason : run.reasons) {
+                        std::cout << "       " << reason << std::endl;
                     }
-                } else if (os == "windows") {
-                    if (d == Debug::G) {
-                        debug_string += " /ZI ";
-                    } else if (d == Debug::Wall) {
-                        debug_string += " /W4 ";
-                    } else if (d == Debug::Wextra) {
-                        debug_string += "";
-                    } else if (d == Debug::Pedantic) {
-                        debug_string += "";
+                    if (run.selected && !affected_only) {
+                        std::cout << "       every test runs without --affected"
+                                  << std::endl;
                     }
                 }
+                tests.push_back(run);
             }
 
-            std::string optimize_string = "";
-            if (os == "linux") {
-                if (options.optimize == Optimize::Debug) {
-                    optimize_string = "-O0";
-                } else if (options.optimize == Optimize::Release) {
-                    optimize_string = "-O3";
-                } else if (options.optimize == Optimize::Embedded) {
-                    optimize_string = "-Os";
+            Jobserver::get().start(getJobCount() * (1 + remote.size()));
+
+            std::map<std::string, std::string> compiles;
+            for (auto &run : tests) {
+                for (size_t i = 0; run.selected && i < run.sources.size(); i++) {
+                    compiles[run.objects[i]] = run.sources[i];
                 }
-            } else if (os == "windows") {
-                if (options.optimize == Optimize::Debug) {
-                    optimize_string = "/Od";
-                } else if (options.optimize == Optimize::Release) {
-                    optimize_string = "/O1";
-                } else if (options.optimize == Optimize::Embedded) {
-                    optimize_string = "/O2";
+            }
+
+            std::atomic<bool> failed = false;
+            JobPool compile_pool(getJobCount());
+            for (auto &[obj, src] : compiles) {
+                std::string command = getCompileCommand(target, src, obj);
+                if (isObjectUpToDate(src, obj, command)) {
+                    continue;
                 }
+                compile_pool.add([this, &failed, target, src, obj, command]() {
+                    std::filesystem::create_directories(
+                        std::filesystem::path(obj).parent_path()
+                    );
+                    int status = compileObject(target, src, obj, command);
+                    if (status == 0) {
+                        writeCommandStamp(obj, command);
+                        addObjectBytesWritten(obj);
+                    } else {
+                        failed = true;
+                    }
+                    return status;
+                });
             }
+            compile_pool.run();
 
-            std::string version_string = "";
-            if (os == "linux") {
-                if (options.version == Version::V11) {
-                    version_string = "-std=c++11";
-                } else if (options.version == Version::V14) {
-                    version_string = "-std=c++14";
-                } else if (options.version == Version::V17) {
-                    version_string = "-std=c++17";
-                } else if (options.version == Version::V20) {
-                    version_string = "-std=c++20";
-                } else if (options.version == Version::V23) {
-                    version_string = "-std=c++23";
+            JobPool link_pool(getJobCount());
+            for (auto &run : tests) {
+                if (failed || !run.selected || isLinkUpToDate(
+                        run.binary, run.binary, run.link_command, run.objects)) {
+                    continue;
                 }
-            } else if (os == "windows") {
-                if (options.version == Version::V11) {
-                    version_string = "/std:c++11";
-                } else if (options.version == Version::V14) {
-                    version_string = "/std:c++14";
-                } else if (options.version == Version::V17) {
-                    version_string = "/std:c++17";
-                } else if (options.version == Version::V20) {
-                    version_string = "/std:c++20";
-                } else if (options.version == Version::V23) {
-                    version_string = "/std:c++latest";
+                std::filesystem::create_directories(
+                    std::filesystem::path(run.binary).parent_path()
+                );
+                link_pool.add([this, &failed, &run]() {
+                    int status = std::system(run.link_command.c_str());
+                    if (status == 0) {
+                        writeCommandStamp(run.binary, run.link_command);
+                    } else {
+                        failed = true;
+                    }
+                    return status;
+                });
+            }
+            link_pool.run();
+            Jobserver::get().stop();
+
+            if (failed) {
+                std::cerr << "Error: building the tests failed" << std::endl;
+                std::exit(1);
+            }
+
+            int passed = 0;
+            int failures = 0;
+            int skipped = 0;
+            for (auto &run : tests) {
+                if (!run.selected) {
+                    skipped++;
+                    continue;
+                }
+
+                std::string command = os == "windows"
+                    ? run.binary : "./" + run.binary;
+                if (std::system(command.c_str()) == 0) {
+                    std::cout << "PASS " << run.name << std::endl;
+                    writeTestPass(target, run);
+                    passed++;
+                } else {
+                    std::cout << "FAIL " << run.name << std::endl;
+                    std::error_code ec;
+                    std::filesystem::remove(run.binary + ".pass", ec);
+                    failures++;
                 }
             }
 
-            if (os == "linux") {
-                if (options.target == Targets::Linux) {
-                    compiler = "g++";
-                } else if (options.target == Targets::Windows) {
-                    compiler = "x86_64-w64-mingw32-g++";
+            std::cout << passed << " passed, " << failures << " failed, "
+                      << skipped << " not affected" << std::endl;
+            if (failures > 0) {
+                std::exit(1);
+            }
+        }
+
+        bool hasArg(std::string arg) {
+            return std::find(command_args.begin(), command_args.end(), arg)
+                != command_args.end();
+        }
+
+        std::string getArg(std::string arg) {
+            for (size_t i = 0; i + 1 < command_args.size(); i++) {
+                if (command_args[i] == arg) {
+                    return command_args[i + 1];
                 }
-            } else if (os == "windows") {
-                if (options.target == Targets::Windows) {
-                    compiler = "cl";
+            }
+
+            return "";
+        }
+
+        // project relative, so depfile and git paths compare equal
+        std::string normalizeProjectPath(std::string path) {
+            std::filesystem::path p = std::filesystem::path(path).lexically_normal();
+            if (p.is_absolute()) {
+                std::filesystem::path rel = p.lexically_relative(
+                    std::filesystem::current_path()
+                );
+                if (!rel.empty() && !rel.generic_string().starts_with("..")) {
+                    p = rel;
                 }
             }
 
-            unsigned long dir_count = include_dirs.size();
-            unsigned long file_count = source_files.size();
-            unsigned long lib_count = libs.size();
+            return p.generic_string();
+        }
 
-            if (os == "linux") {
-                if (dir_count == 0 && file_count == 0 && lib_count == 0) {
-                    std::string exe = compiler + " "
-                        + debug_string
-                        + optimize_string + " "
-                        + version_string + " "
-                        + options.root_source_file
-                        + " -o "
-                        + options.name;
-
-                    return exe;
-                } else {
-                    std::string dir_string = "";
-                    std::string file_string = "";
-                    std::string lib_string = "";
-                    std::string lib_dir_string = "";
+        // every file a test binary was built from, the sources plus the
+        // headers listed in their depfiles. Sources that were never built
+        // have no depfile and are returned in unknown.
+        std::set<std::string> getTestInputs(
+            TestRun &run,
+            std::vector<std::string> &unknown
+        ) {
+            std::set<std::string> inputs;
+            for (size_t i = 0; i < run.sources.size(); i++) {
+                inputs.insert(normalizeProjectPath(run.sources[i]));
 
-                    for (auto dir : include_dirs) {
-                        std::string temp = " " + dir + " ";
-                        dir_string += temp;
-                    }
+                std::filesystem::path dep_file = run.objects[i];
+                dep_file.replace_extension(".d");
+                if (!std::filesystem::exists(dep_file)) {
+                    unknown.push_back(run.sources[i]);
+                    continue;
+                }
+                for (auto dep : readDepFile(run.objects[i])) {
+                    inputs.insert(normalizeProjectPath(dep));
+                }
+            }
 
-                    for (auto f : source_files) {
-                        std::string temp = " " + f + " ";
-                        file_string += temp;
-                    }
+            return inputs;
+        }
 
-                    for (auto libd : lib_dirs) {
-                        std::string temp = " " + libd + " ";
-                        lib_dir_string += temp;
-                    }
+        std::set<std::string> getGitChanges(std::string ref) {
+            std::string null_dev = os == "windows" ? "NUL" : "/dev/null";
+            std::string output = readCommand(
+                "git diff --name-only --relative " + ref + " 2>" + null_dev
+            ) + readCommand(
+                "git ls-files --others --exclude-standard 2>" + null_dev
+            );
 
-                    for (auto lib : libs) {
-                        std::string temp = " " + lib + " ";
-                        lib_string += temp;
-                    }
+            std::set<std::string> changed;
+            std::istringstream lines(output);
+            std::string line;
+            while (std::getline(lines, line)) {
+                if (line != "") {
+                    changed.insert(normalizeProjectPath(line));
+                }
+            }
+
+            return changed;
+        }
 
-                    std::string exe = compiler + " "
-                        + debug_string
-                        + optimize_string + " "
-                        + version_string + " "
-                        + dir_string
-                        + lib_dir_string
-                        + file_string
-                        + options.root_source_file
-                        + " -o "
-                        + options.name
-                        + lib_string;
+        std::vector<std::string> getChangedReasons(
+            TestRun &run,
+            std::set<std::string> &changed,
+            std::string ref
+        ) {
+            std::vector<std::string> reasons;
+            std::vector<std::string> unknown;
+            std::set<std::string> inputs = getTestInputs(run, unknown);
+            inputs.insert("build.cpp");
+            inputs.insert("cppc.toml");
 
-                    return exe;
+            for (auto src : unknown) {
+                reasons.push_back(src + " was never built, its headers "
+                                  "are unknown");
+            }
+            for (auto input : inputs) {
+                if (changed.contains(input)) {
+                    reasons.push_back(input + " changed since " + ref);
                 }
-            } else if (os == "windows") {
-                if (dir_count == 0 && file_count == 0 && lib_count == 0) {
-                    std::string exe = compiler + " "
-                        + debug_string
-                        + optimize_string + " "
-                        + version_string + " "
-                        + cleanUpSubDir(options.root_source_file)
-                        + " /Fe"
-                        + options.name
-                        + ".exe";
-
-                    return exe;
-                } else {
-                    std::string dir_string = "";
-                    std::string file_string = "";
-                    std::string lib_string = "";
-                    std::string lib_dir_string = "";
+            }
+
+            return reasons;
+        }
+
+        std::vector<std::string> getStaleReasons(Targets target, TestRun &run) {
+            std::vector<std::string> reasons;
+            std::ifstream pass(run.binary + ".pass");
+            if (!pass.is_open()) {
+                reasons.push_back("no successful run recorded");
+                return reasons;
+            }
+
+            std::string config;
+            std::getline(pass, config);
+            if (config != getTestConfigHash(target, run)) {
+                reasons.push_back("build settings changed");
+            }
+
+            std::map<std::string, std::string> recorded;
+            std::string line;
+            while (std::getline(pass, line)) {
+                size_t tab = line.find('\t');
+                if (tab != std::string::npos) {
+                    recorded[line.substr(tab + 1)] = line.substr(0, tab);
+                }
+            }
+
+            std::vector<std::string> unknown;
+            for (auto input : getTestInputs(run, unknown)) {
+                if (!recorded.contains(input)) {
+                    reasons.push_back(input + " is a new input");
+                } else if (recorded[input] != getFileSignature(input)) {
+                    reasons.push_back(input + " changed since the last pass");
+                }
+            }
+            for (auto src : unknown) {
+                reasons.push_back(src + " was never built");
+            }
+
+            return reasons;
+        }
+
+        std::string getTestConfigHash(Targets target, TestRun &run) {
+            uint64_t hash = hashString(run.link_command);
+            for (size_t i = 0; i < run.sources.size(); i++) {
+                hash = hashString(getCompileCommand(
+                    target, run.sources[i], run.objects[i]
+                ), hash);
+            }
+
+            return hashToHex(hash);
+        }
+
+        std::string getFileSignature(std::string path) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(path, ec);
+            if (ec) {
+                return "missing";
+            }
+            auto time = std::filesystem::last_write_time(path, ec);
+
+            return std::to_string(size) + ":"
+                + std::to_string(time.time_since_epoch().count());
+        }
+
+        void writeTestPass(Targets target, TestRun &run) {
+            std::vector<std::string> unknown;
+            std::set<std::string> inputs = getTestInputs(run, unknown);
+
+            std::ofstream pass(run.binary + ".pass", std::ios::out);
+            pass << getTestConfigHash(target, run) << std::endl;
+            for (auto input : inputs) {
+                pass << getFileSignature(input) << "\t" << input << std::endl;
+            }
+        }
+
+        void reportSize(Targets target, std::vector<std::string> objects) {
+            if (target != Targets::Linux) {
+                std::cout << "Size analysis only supports ELF outputs, "
+                          << "skipping the " << getTargetName(target)
+                          << " target" << std::endl;
+                return;
+            }
+
+            std::string output = getOutputName(target);
+            SizeAnalyzer after;
+            if (!after.load(output, getMapPath(target, output))) {
+                return;
+            }
+            after.printReport(getTopCount());
+
+            if (!options.gc_sections && !options.icf) {
+                return;
+            }
+
+            // relink the same objects without --gc-sections and --icf to
+            // show what they saved
+            std::string baseline = (std::filesystem::path(build_dir)
+                / getTargetName(target) / (options.name + ".baseline")).string();
+            std::string command = getLinkCommand(
+                target, objects, baseline, false
+            );
+            SizeAnalyzer before;
+            if (std::system(command.c_str()) != 0
+                || !before.load(baseline, getMapPath(target, baseline))) {
+                std::cerr << "Error: could not link the baseline for "
+                          << "the size comparison" << std::endl;
+                return;
+            }
+
+            std::cout << "\nWithout gc-sections/icf: "
+                      << before.getAllocatedSize() << " bytes loaded, with: "
+                      << after.getAllocatedSize() << " bytes loaded"
+                      << std::endl;
+        }
+
+        // cppc size --diff <before> <after> [--max-growth <bytes>]
+        void diffSizes() {
+            if (command_args.size() < 3) {
+                std::cerr << "Usage: cppc size --diff <before> <after> "
+                          << "[--max-growth <bytes>]" << std::endl;
+                std::exit(2);
+            }
+
+            // validated before anything is printed
+            size_t top = getTopCount();
+            bool has_limit = false;
+            int64_t max_growth = 0;
+            for (size_t i = 3; i + 1 < command_args.size(); i++) {
+                if (command_args[i] == "--max-growth") {
+                    has_limit = true;
+                    max_growth = parseNumberArg(
+                        command_args[i], command_args[i + 1]
+                    );
+                }
+            }
+
+            SizeAnalyzer before;
+            SizeAnalyzer after;
+            if (!before.load(command_args[1], findMapFile(command_args[1]))
+                || !after.load(command_args[2], findMapFile(command_args[2]))) {
+                std::exit(2);
+            }
+
+            int64_t growth = SizeAnalyzer::printDiff(before, after, top);
+            if (has_limit && growth > max_growth) {
+                std::cerr << "Error: size grew by " << growth
+                          << " bytes, limit is " << max_growth << std::endl;
+                std::exit(1);
+            }
+        }
+
+        // only a map written next to the binary describes it, the map in the
+        // build directory belongs to whatever was built last
+        std::string findMapFile(std::string binary) {
+            std::string beside = binary + ".map";
+            if (std::filesystem::exists(beside)) {
+                return beside;
+            }
+
+            std::cerr << "Note: no " << beside << ", the object file table "
+                      << "is skipped for " << binary << std::endl;
+            return "";
+        }
+
+        // exits with a message instead of letting std::stoll throw
+        int64_t parseNumberArg(std::string flag, std::string value) {
+            size_t used = 0;
+            int64_t number = 0;
+            try {
+                number = std::stoll(value, &used);
+            } catch (const std::exception &) {
+                used = 0;
+            }
+            if (used == 0 || used != value.size()) {
+                std::cerr << "Error: " << flag << " expects a number, got "
+                          << value << std::endl;
+                std::exit(2);
+            }
 
-                    for (auto dir : include_dirs) {
-                        std::string temp = " " + dir + " ";
-                        dir_string += temp;
+            return number;
+        }
+
+        // cppc run --profile builds an optimized binary with frame pointers
+        // and debug info into cppc-build/profile, leaving the normal build
+        // and compile_commands.json alone
+        bool useProfileVariant() {
+            if (os != "linux") {
+                std::cerr << "Error: --profile is only supported on linux"
+                          << std::endl;
+                return false;
+            }
+
+            profile = true;
+            options.optimize = Optimize::Release;
+            if (!hasDebugG()) {
+                options.debug.push_back(Debug::G);
+            }
+            options.debug_info = DebugInfo::Full;
+            options.target = getHostTarget();
+            options.targets = {getHostTarget()};
+            build_dir = (std::filesystem::path(build_dir) / "profile").string();
+            options.name = (std::filesystem::path(build_dir) / options.name)
+                .string();
+
+            return true;
+        }
+
+        // samples with perf when it is installed and allowed to record,
+        // otherwise with the sampler from profiler.cpp
+        void runProfile(std::string run) {
+            std::filesystem::path dir = build_dir;
+            std::string name = std::filesystem::path(options.name)
+                .filename().string();
+            std::vector<std::vector<std::string>> stacks;
+            std::string profiler = "perf";
+
+            if (std::system("command -v perf > /dev/null 2>&1") == 0) {
+                std::string data = (dir / "perf.data").string();
+                std::system(("perf record -F 999 -g -o " + data + " " + run)
+                    .c_str());
+                stacks = readPerfStacks(
+                    readCommand("perf script -i " + data + " 2> /dev/null")
+                );
+                if (stacks.empty()) {
+                    std::cerr << "perf recorded no samples, using the cppc "
+                              << "sampler" << std::endl;
+                }
+            }
+
+            if (stacks.empty()) {
+                std::string library = buildSampler();
+                if (library == "") {
+                    std::exit(1);
+                }
+
+                std::string samples = (dir / "samples.txt").string();
+                std::error_code ec;
+                std::filesystem::remove(samples, ec);
+                std::system(("CPPC_PROFILE_OUT=" + samples + " LD_PRELOAD="
+                    + library + " " + run).c_str());
+                stacks = readSamplerStacks(samples);
+                profiler = "the cppc sampler";
+            }
+
+            reportProfile(stacks, (dir / (name + ".folded")).string(), profiler);
+        }
+
+        std::string buildSampler() {
+            std::filesystem::path source = getHomePath()
+                + "/.config/.cppc/profiler.cpp";
+            std::filesystem::path library = std::filesystem::absolute(
+                std::filesystem::path(build_dir) / "libcppc_profiler.so"
+            );
+            if (!std::filesystem::exists(source)) {
+                std::cerr << "Error: " << source.string() << " is missing, "
+                          << "run install.sh again" << std::endl;
+                return "";
+            }
+
+            std::error_code ec;
+            if (!std::filesystem::exists(library)
+                || std::filesystem::last_write_time(library, ec)
+                    < std::filesystem::last_write_time(source, ec)) {
+                std::string command = Toolchain::get().getCompiler()
+                    + " -std=c++17 -O2 -fPIC -shared " + source.string()
+                    + " -o " + library.string() + " -ldl";
+                if (std::system(command.c_str()) != 0) {
+                    std::cerr << "Error: could not build the sampler"
+                              << std::endl;
+                    return "";
+                }
+            }
+
+            return library.string();
+        }
+
+        // perf script prints a header line per sample followed by one
+        // indented "address symbol+offset (module)" line per frame, leaf
+        // first, and a blank line
+        std::vector<std::vector<std::string>> readPerfStacks(std::string text) {
+            std::vector<std::vector<std::string>> stacks;
+            std::vector<std::string> stack;
+            std::istringstream lines(text);
+            std::string line;
+            while (std::getline(lines, line)) {
+                if (line == "" || (line[0] != ' ' && line[0] != '\t')) {
+                    if (!stack.empty()) {
+                        std::reverse(stack.begin(), stack.end());
+                        stacks.push_back(stack);
+                        stack.clear();
+                    }
+                    continue;
+                }
+
+                std::istringstream frame(line);
+                std::string address;
+                std::string symbol;
+                frame >> address;
+                std::getline(frame >> std::ws, symbol);
+                size_t module = symbol.rfind(" (");
+                if (module != std::string::npos) {
+                    symbol = symbol.substr(0, module);
+                }
+                size_t offset = symbol.rfind("+0x");
+                if (offset != std::string::npos) {
+                    symbol = symbol.substr(0, offset);
+                }
+                stack.push_back(symbol == "" ? "[unknown]" : symbol);
+            }
+            if (!stack.empty()) {
+                std::reverse(stack.begin(), stack.end());
+                stacks.push_back(stack);
+            }
+
+            return stacks;
+        }
+
+        // frames the sampler could not name are "?<module>@<address>" and
+        // are resolved here with one addr2line run per module. Functions
+        // inlined at an address become frames of their own.
+        std::vector<std::vector<std::string>> readSamplerStacks(
+            std::string path
+        ) {
+            std::vector<std::vector<std::string>> raw_stacks;
+            std::map<std::string, std::set<std::string>> unresolved;
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::vector<std::string> stack;
+                std::istringstream frames(line);
+                std::string frame;
+                while (std::getline(frames, frame, '\t')) {
+                    size_t at = frame.rfind('@');
+                    if (frame[0] == '?' && at != std::string::npos) {
+                        unresolved[frame.substr(1, at - 1)].insert(
+                            frame.substr(at + 1)
+                        );
                     }
+                    stack.push_back(frame);
+                }
+                if (!stack.empty()) {
+                    std::reverse(stack.begin(), stack.end());
+                    raw_stacks.push_back(stack);
+                }
+            }
 
-                    for (auto f : source_files) {
-                        std::string temp = " " + f + " ";
-                        file_string += temp;
+            // with -a every address is echoed before its function and
+            // location lines, innermost inlined function first
+            std::map<std::string, std::vector<std::string>> names;
+            for (auto &[module, addresses] : unresolved) {
+                std::vector<std::string> list(addresses.begin(), addresses.end());
+                std::string base = std::filesystem::path(module)
+                    .filename().string();
+                for (size_t i = 0; i < list.size(); i += 256) {
+                    std::string command = "addr2line -a -f -i -C -e " + module;
+                    size_t end = std::min(list.size(), i + 256);
+                    for (size_t j = i; j < end; j++) {
+                        command += " 0x" + list[j];
                     }
+                    std::istringstream output(
+                        readCommand(command + " 2> /dev/null")
+                    );
+                    size_t j = i - 1;
+                    std::string function;
+                    std::string location;
+                    while (std::getline(output, function)) {
+                        if (function.rfind("0x", 0) == 0) {
+                            j++;
+                            continue;
+                        }
+                        std::getline(output, location);
+                        if (j < i || j >= end) {
+                            continue;
+                        }
+                        if (function == "??") {
+                            function = base + "+0x" + list[j];
+                        }
+                        auto &resolved = names["?" + module + "@" + list[j]];
+                        resolved.insert(resolved.begin(), function);
+                    }
+                }
+            }
 
-                    for (auto libd : lib_dirs) {
-                        std::string temp = " " + libd + " ";
-                        lib_dir_string += temp;
+            std::vector<std::vector<std::string>> stacks;
+            for (auto &raw_stack : raw_stacks) {
+                std::vector<std::string> stack;
+                for (auto &frame : raw_stack) {
+                    auto found = names.find(frame);
+                    if (found == names.end()) {
+                        stack.push_back(frame);
+                    } else {
+                        stack.insert(stack.end(), found->second.begin(),
+                                     found->second.end());
                     }
+                }
+                stacks.push_back(stack);
+            }
+
+            return stacks;
+        }
+
+        // writes <name>.folded for flamegraph.pl or speedscope and prints
+        // the functions with the most samples, self and including callees
+        void reportProfile(
+            std::vector<std::vector<std::string>> &stacks,
+            std::string folded_path,
+            std::string profiler
+        ) {
+            if (stacks.empty()) {
+                std::cerr << "Error: no samples were recorded" << std::endl;
+                std::exit(1);
+            }
 
-                    for (auto lib : libs) {
-                        std::string temp = " " + lib + " ";
-                        lib_string += temp;
+            std::map<std::string, uint64_t> folded;
+            std::map<std::string, uint64_t> self;
+            std::map<std::string, uint64_t> total;
+            for (auto &stack : stacks) {
+                std::string key = "";
+                std::set<std::string> seen;
+                for (auto frame : stack) {
+                    std::replace(frame.begin(), frame.end(), ';', ':');
+                    key += (key == "" ? "" : ";") + frame;
+                    if (seen.insert(frame).second) {
+                        total[frame]++;
                     }
+                }
+                folded[key]++;
+                self[stack.back()]++;
+            }
+
+            std::ofstream file(folded_path);
+            for (auto &[key, count] : folded) {
+                file << key << " " << count << "\n";
+            }
+
+            std::vector<std::pair<std::string, uint64_t>> sorted(
+                self.begin(), self.end()
+            );
+            std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+                return a.second > b.second;
+            });
+
+            uint64_t samples = stacks.size();
+            auto percent = [samples](uint64_t count) {
+                uint64_t tenths = count * 1000 / samples;
+                std::string value = std::to_string(tenths / 10) + "."
+                    + std::to_string(tenths % 10) + "%";
+                return std::string(7 - std::min<size_t>(value.size(), 7), ' ')
+                    + value;
+            };
 
-                    std::string exe = compiler + " "
-                        + debug_string
-                        + optimize_string + " "
-                        + version_string + " "
-                        + dir_string
-                        + lib_dir_string
-                        + file_string
-                        + cleanUpSubDir(options.root_source_file)
-                        + " /Fe"
-                        + options.name
-                        + ".exe "
-                        + lib_string;
+            std::cout << "\n" << samples << " samples recorded with "
+                      << profiler << ", folded stacks in " << folded_path
+                      << std::endl;
+            std::cout << "\n   self    total  function" << std::endl;
+            size_t top = getTopCount();
+            for (size_t i = 0; i < sorted.size() && i < top; i++) {
+                std::cout << percent(sorted[i].second) << "  "
+                          << percent(total[sorted[i].first]) << "  "
+                          << sorted[i].first << std::endl;
+            }
+        }
 
-                    return exe;
+        size_t getTopCount() {
+            for (size_t i = 0; i + 1 < command_args.size(); i++) {
+                if (command_args[i] == "--top") {
+                    int64_t top = parseNumberArg("--top", command_args[i + 1]);
+                    if (top <= 0) {
+                        std::cerr << "Error: --top expects a positive number"
+                                  << std::endl;
+                        std::exit(2);
+                    }
+                    return top;
                 }
-            } else {
-                return "";
             }
+
+            return 20;
         }
 
         std::string removeFirstTwoChars(std::string item) {
             return item.erase(0, 2);
         }
 
+        std::string getProjectPath() {
+            return std::filesystem::current_path().generic_string();
+        }
+
         std::string getHomePath() {
             std::string home = std::getenv("HOME");
             return home;
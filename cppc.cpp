@@ -5,58 +5,95 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <map>
+#include <algorithm>
 
-///////////////////////////////////////////////////////////////////////////////
-// preprocessor commands
-///////////////////////////////////////////////////////////////////////////////
-#ifdef _WIN32
-    std::string os = "windows";
-    std::string compiler = "cl";
-    std::string compiler_full_path = "";
-#elif __APPLE__
-    std::string os = "macos";
-    std::string compiler = "clang++";
-    std::string compiler_full_path = "";
-#elif __linux__
-    std::string os = "linux";
-    std::string compiler = "g++";
-    std::string compiler_full_path = "/usr/bin/g++";
-#else
-    std::string os = "linux";
-    std::string compiler = "g++";
-    std::string compiler_full_path = "/usr/bin/g++";
+#include <sstream>
+
+#ifndef _WIN32
+    #include <sys/wait.h>
 #endif
 
+// builder.h also defines os and Toolchain
+#include "builder.h"
+
 ///////////////////////////////////////////////////////////////////////////////
 // function prototypes
 ///////////////////////////////////////////////////////////////////////////////
-void handleLinuxArgs(std::string cmd, std::string opt1);
+void handleLinuxArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+);
 void buildLinux(bool is_verbose);
-void runLinux(bool is_verbose);
-void runLinuxTest(bool is_verbose);
-void createLinuxBuildCpp(std::filesystem::path build_cpp);
+void runLinux(bool is_verbose, std::vector<std::string> args);
+void runLinuxTest(bool is_verbose, std::vector<std::string> args);
+void sizeLinux(std::vector<std::string> args);
+void benchLinux(std::vector<std::string> args);
+void createBenchProject(
+    std::filesystem::path dir,
+    int tus,
+    int headers,
+    int fanout,
+    int depth
+);
+double timeCommand(std::string command, bool *ok);
+int parseCountArg(std::string flag, std::string value, int minimum);
+void createLinuxBuildCpp(
+    std::filesystem::path build_cpp,
+    std::vector<std::string> include_dirs = {},
+    std::vector<std::string> source_files = {},
+    bool reproducible = false
+);
 void createLinuxCompileCommands(std::string project_name);
 
-void handleWindowsArgs(std::string cmd, std::string opt1);
+void handleWindowsArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+);
 void buildWindows(bool is_verbose);
 void runWindows(bool is_verbose);
-void runWindowsTest(bool is_verbose);
+void runWindowsTest(bool is_verbose, std::vector<std::string> args);
 void createWindowsBuildCpp(std::filesystem::path build_cpp);
 void createWindowsCompileCommands(std::string project_name);
 
 void handleMacosArgs(std::string cmd, std::string opt1);
 
 void printHelp();
-void handleArgs(std::string cmd, std::string opt1);
+void printToolchain();
+void runWorker(std::vector<std::string> args);
+bool manifestExists();
+void buildFromManifest(std::string cmd, std::vector<std::string> args);
+void parseManifest(std::string path, Builder &builder);
+std::vector<std::string> parseManifestValue(
+    std::string path,
+    int line_number,
+    std::string value
+);
+bool isOpenManifestArray(std::string value);
+void createManifest(std::filesystem::path manifest);
+void handleArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+);
+std::string quoteArgs(std::vector<std::string> args);
+int getExitCode(int status);
 bool buildFileExists();
 void createMainCpp(std::filesystem::path main_cpp);
-void createProject(std::string project_name);
+void createProject(std::string project_name, bool manifest = false);
 
 ///////////////////////////////////////////////////////////////////////////////
 // linux functions
 ///////////////////////////////////////////////////////////////////////////////
 void
-handleLinuxArgs(std::string cmd, std::string opt1) {
+handleLinuxArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+) {
     if (cmd == "--help") {
         printHelp();
     } else if (cmd == "build" && opt1 != "-v") {
@@ -64,15 +101,26 @@ handleLinuxArgs(std::string cmd, std::string opt1) {
     } else if (cmd == "build" && opt1 == "-v") {
         buildLinux(true);
     } else if (cmd == "run" && opt1 != "-v") {
-        runLinux(false);
+        runLinux(false, args);
     } else if (cmd == "run" && opt1 == "-v") {
-        runLinux(true);
+        runLinux(true, args);
     } else if (cmd == "test" && opt1 != "-v") {
-        runLinuxTest(false);
+        runLinuxTest(false, args);
     } else if (cmd == "test" && opt1 == "-v") {
-        runLinuxTest(true);
+        runLinuxTest(true, args);
+    } else if (cmd == "size") {
+        sizeLinux(args);
+    } else if (cmd == "bench") {
+        benchLinux(args);
+    } else if (cmd == "worker") {
+        runWorker(args);
+    } else if (cmd == "toolchain") {
+        printToolchain();
     } else if (cmd == "new" && opt1 != "") {
-        createProject(opt1);
+        createProject(
+            opt1,
+            std::find(args.begin(), args.end(), "--toml") != args.end()
+        );
     } else {
         printHelp();
     }
@@ -80,59 +128,288 @@ handleLinuxArgs(std::string cmd, std::string opt1) {
 
 void
 buildLinux(bool is_verbose) {
+    if (manifestExists()) {
+        buildFromManifest("build", {});
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
 
-    std::string command = compiler
+    std::string command = Toolchain::get().getCompiler()
         + " -std=c++23 -I$HOME/.config/.cppc build.cpp -o build && ./build";
     std::string clean = "rm -rf build";
 
     if (is_verbose) {
         std::cout << command << std::endl;
-        system(command.c_str());
         std::cout << clean << std::endl;
-        system(clean.c_str());
-    } else {
-        system(command.c_str());
-        system(clean.c_str());
+    }
+    int status = getExitCode(system(command.c_str()));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
     }
 }
 
 void
-runLinux(bool is_verbose) {
+runLinux(bool is_verbose, std::vector<std::string> args) {
+    if (manifestExists()) {
+        buildFromManifest("run", args);
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
 
-    std::string command = compiler
+    std::string command = Toolchain::get().getCompiler()
         + " -std=c++23 -I$HOME/.config/.cppc build.cpp -o "
-        "build && ./build run";
+        "build && ./build run" + quoteArgs(args);
     std::string clean = "rm -rf build";
 
     if (is_verbose) {
         std::cout << command << std::endl;
         std::cout << clean << std::endl;
-        system(command.c_str());
-        system(clean.c_str());
-    } else {
-        system(command.c_str());
-        system(clean.c_str());
+    }
+    int status = getExitCode(system(command.c_str()));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
+    }
+}
+
+void
+runLinuxTest(bool is_verbose, std::vector<std::string> args) {
+    if (manifestExists()) {
+        buildFromManifest("test", args);
+        return;
+    }
+
+    if (!buildFileExists()) {
+        std::cout << "No build.cpp file exists." << std::endl;
+        return;
+    }
+
+    std::string command = Toolchain::get().getCompiler()
+        + " -std=c++23 -I$HOME/.config/.cppc build.cpp -o build && ./build test"
+        + quoteArgs(args);
+    std::string clean = "rm -rf build";
+
+    if (is_verbose) {
+        std::cout << command << std::endl;
+        std::cout << clean << std::endl;
+    }
+    int status = getExitCode(system(command.c_str()));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
     }
 }
 
 void
-runLinuxTest(bool is_verbose) {
+sizeLinux(std::vector<std::string> args) {
+    if (manifestExists()) {
+        buildFromManifest("size", args);
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
+
+    std::string command = Toolchain::get().getCompiler()
+        + " -std=c++23 -I$HOME/.config/.cppc build.cpp -o build && ./build size"
+        + quoteArgs(args);
+    std::string clean = "rm -rf build";
+
+    int status = getExitCode(system(command.c_str()));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
+    }
+}
+
+// cppc bench [--tus n] [--headers n] [--fanout n] [--depth n] [--runs n]
+//            [--include dir] [--dir path]
+void
+benchLinux(std::vector<std::string> args) {
+    std::map<std::string, std::string> flags = {
+        {"--tus", "100"},
+        {"--headers", "20"},
+        {"--fanout", "5"},
+        {"--depth", "8"},
+        {"--runs", "3"},
+        {"--include", std::string(std::getenv("HOME")) + "/.config/.cppc"},
+        {"--dir", "cppc-bench"},
+    };
+    for (size_t i = 0; i + 1 < args.size(); i += 2) {
+        if (!flags.contains(args[i])) {
+            std::cerr << "Error: unknown bench option " << args[i] << std::endl;
+            std::exit(2);
+        }
+        flags[args[i]] = args[i + 1];
+    }
+
+    int tus = parseCountArg("--tus", flags["--tus"], 1);
+    int headers = parseCountArg("--headers", flags["--headers"], 0);
+    int fanout = parseCountArg("--fanout", flags["--fanout"], 0);
+    int depth = parseCountArg("--depth", flags["--depth"], 0);
+    int runs = parseCountArg("--runs", flags["--runs"], 1);
+    std::filesystem::path dir = flags["--dir"];
+    std::string include_dir = std::filesystem::absolute(flags["--include"]).string();
+
+    std::filesystem::remove_all(dir);
+    createBenchProject(dir, tus, headers, fanout, depth);
+
+    // a cache of its own so the clean builds start cold
+    std::filesystem::path cache_dir = std::filesystem::absolute(dir / "cache");
+    std::filesystem::create_directories(cache_dir);
+    std::string cd = "cd " + dir.string() + " && export CPPC_CACHE_DIR=\""
+        + cache_dir.string() + "\" && ";
+    std::string driver = cd + Toolchain::get().getCompiler() + " -std=c++23 -I" + include_dir
+        + " build.cpp -o build";
+    std::string build = cd + "./build > /dev/null";
+    std::string wipe = cd + "rm -rf cppc-build app cache/*";
+    std::string wipe_build = cd + "rm -rf cppc-build app";
+    std::string touch = cd + "echo '// touched' >> src/tu0.cpp";
+
+    std::vector<std::string> names = {
+        "driver", "clean", "noop", "incremental", "cache_hit"
+    };
+    std::map<std::string, std::vector<double>> results;
+    bool ok = true;
+
+    for (int r = 0; r < runs && ok; r++) {
+        results["driver"].push_back(timeCommand(driver, &ok));
+        system(wipe.c_str());
+        results["clean"].push_back(timeCommand(build, &ok));
+        results["noop"].push_back(timeCommand(build, &ok));
+        system(touch.c_str());
+        results["incremental"].push_back(timeCommand(build, &ok));
+        // the build directory goes away but the object cache stays warm
+        system(wipe_build.c_str());
+        results["cache_hit"].push_back(timeCommand(build, &ok));
+    }
+
+    if (!ok) {
+        std::cerr << "Error: benchmark build failed in " << dir << std::endl;
+        std::exit(1);
+    }
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"shape\": {\"tus\": " << tus
+              << ", \"headers\": " << headers
+              << ", \"fanout\": " << fanout
+              << ", \"depth\": " << depth
+              << ", \"runs\": " << runs << "}," << std::endl;
+    std::cout << "  \"results\": {" << std::endl;
+    for (size_t i = 0; i < names.size(); i++) {
+        std::vector<double> times = results[names[i]];
+        std::sort(times.begin(), times.end());
+        std::cout << "    \"" << names[i] << "\": {\"median_s\": "
+                  << times[times.size() / 2] << ", \"runs_s\": [";
+        for (size_t j = 0; j < results[names[i]].size(); j++) {
+            std::cout << (j == 0 ? "" : ", ") << results[names[i]][j];
+        }
+        std::cout << "]}" << (i + 1 == names.size() ? "" : ",") << std::endl;
+    }
+    std::cout << "  }" << std::endl;
+    std::cout << "}" << std::endl;
+}
+
+// every header carries a recursive function template <depth> levels deep,
+// every translation unit includes <fanout> of the headers
+void
+createBenchProject(
+    std::filesystem::path dir,
+    int tus,
+    int headers,
+    int fanout,
+    int depth
+) {
+    createProject(dir.string());
+    std::filesystem::create_directories(dir / "include");
+
+    for (int h = 0; h < headers; h++) {
+        std::ofstream file(dir / "include" / ("h" + std::to_string(h) + ".h"));
+        file << "#pragma once\n" << std::endl;
+        file << "template <int N>" << std::endl;
+        file << "inline long h" << h << "_chain(long x) {" << std::endl;
+        file << "    if constexpr (N == 0) {" << std::endl;
+        file << "        return x;" << std::endl;
+        file << "    } else {" << std::endl;
+        file << "        return h" << h << "_chain<N - 1>(x * "
+             << (h + 3) << " + N);" << std::endl;
+        file << "    }" << std::endl;
+        file << "}" << std::endl;
+        file.close();
+    }
+
+    std::vector<std::string> sources;
+    for (int t = 0; t < tus; t++) {
+        std::string name = "tu" + std::to_string(t) + ".cpp";
+        std::ofstream file(dir / "src" / name);
+        for (int f = 0; f < fanout && headers > 0; f++) {
+            file << "#include \"h" << (t * 7 + f * 13) % headers
+                 << ".h\"" << std::endl;
+        }
+        file << "\nlong tu" << t << "(long x) {" << std::endl;
+        file << "    long sum = x;" << std::endl;
+        for (int f = 0; f < fanout && headers > 0; f++) {
+            file << "    sum += h" << (t * 7 + f * 13) % headers
+                 << "_chain<" << depth << ">(sum);" << std::endl;
+        }
+        file << "    return sum;" << std::endl;
+        file << "}" << std::endl;
+        file.close();
+        sources.push_back("./src/" + name);
+    }
+
+    // reproducible so objects go through the cache that cache_hit measures
+    createLinuxBuildCpp(dir / "build.cpp", {"-I./include"}, sources, true);
+}
+
+double
+timeCommand(std::string command, bool *ok) {
+    auto start = std::chrono::steady_clock::now();
+    if (system(command.c_str()) != 0) {
+        *ok = false;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// a whole number of at least <minimum>, anything else is a usage error
+int
+parseCountArg(std::string flag, std::string value, int minimum) {
+    size_t used = 0;
+    int number = 0;
+    try {
+        number = std::stoi(value, &used);
+    } catch (const std::exception &) {
+        used = 0;
+    }
+    if (used == 0 || used != value.size() || number < minimum) {
+        std::cerr << "Error: " << flag << " expects a number of at least "
+                  << minimum << ", got " << value << std::endl;
+        std::exit(2);
+    }
+
+    return number;
 }
 
 void
-createLinuxBuildCpp(std::filesystem::path build_cpp) {
+createLinuxBuildCpp(
+    std::filesystem::path build_cpp,
+    std::vector<std::string> include_dirs,
+    std::vector<std::string> source_files,
+    bool reproducible
+) {
     std::ofstream file(build_cpp);
     file << "#include <vector>\n" << std::endl;
     file << "#include \"builder.h\"\n" << std::endl;
@@ -150,7 +427,19 @@ createLinuxBuildCpp(std::filesystem::path build_cpp) {
     file << "        .debug = debug," << std::endl;
     file << "        .optimize = Optimize::Debug," << std::endl;
     file << "        .target = Targets::Linux," << std::endl;
+    if (reproducible) {
+        file << "        .reproducible = true," << std::endl;
+    }
     file << "    });\n" << std::endl;
+    for (auto dir : include_dirs) {
+        file << "    builder.addIncludeDir(\"" << dir << "\");" << std::endl;
+    }
+    for (auto f : source_files) {
+        file << "    builder.addSourceFile(\"" << f << "\");" << std::endl;
+    }
+    if (!include_dirs.empty() || !source_files.empty()) {
+        file << std::endl;
+    }
     file << "    builder.build();" << std::endl;
     file << "}" << std::endl;
     file.close();
@@ -178,7 +467,7 @@ createLinuxCompileCommands(std::string project_name) {
     file << "[" << std::endl;
     file << "  {" << std::endl;
     file << "    \"arguments\": [" << std::endl;
-    file << "      \"" + compiler_full_path + "\"," << std::endl;
+    file << "      \"" + Toolchain::get().getPath() + "\"," << std::endl;
     file << "      \"-c\"," << std::endl;
     file << "      \"-g\"," << std::endl;
     file << "      \"-Wall\"," << std::endl;
@@ -204,7 +493,11 @@ createLinuxCompileCommands(std::string project_name) {
 // windows functions
 ///////////////////////////////////////////////////////////////////////////////
 void
-handleWindowsArgs(std::string cmd, std::string opt1) {
+handleWindowsArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+) {
     if (cmd == "--help") {
         printHelp();
     } else if (cmd == "build" && opt1 != "-v") {
@@ -216,11 +509,22 @@ handleWindowsArgs(std::string cmd, std::string opt1) {
     } else if (cmd == "run" && opt1 == "-v") {
         runWindows(true);
     } else if (cmd == "test" && opt1 != "-v") {
-        runWindowsTest(false);
+        runWindowsTest(false, args);
     } else if (cmd == "test" && opt1 == "-v") {
-        runWindowsTest(true);
+        runWindowsTest(true, args);
+    } else if (cmd == "size") {
+        std::cout << "Size analysis is not supported on Windows yet"
+                  << std::endl;
+    } else if (cmd == "bench") {
+        std::cout << "Benchmarks are not supported on Windows yet"
+                  << std::endl;
+    } else if (cmd == "worker") {
+        runWorker(args);
     } else if (cmd == "new" && opt1 != "") {
-        createProject(opt1);
+        createProject(
+            opt1,
+            std::find(args.begin(), args.end(), "--toml") != args.end()
+        );
     } else {
         printHelp();
     }
@@ -228,13 +532,18 @@ handleWindowsArgs(std::string cmd, std::string opt1) {
 
 void
 buildWindows(bool is_verbose) {
+    if (manifestExists()) {
+        buildFromManifest("build", {});
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
 
     std::string command = "cmd.exe /c \""
-        + compiler
+        + Toolchain::get().getCompiler()
         + " /std:c++latest /EHsc /I\"%USERPROFILE%\\.config\\.cppc\" "
         "build.cpp /Febuild.exe\"";
     std::string command_exe = "cmd.exe /c \"build.exe\"";
@@ -242,29 +551,32 @@ buildWindows(bool is_verbose) {
 
     if (is_verbose) {
         std::cout << command << std::endl;
-        system(command.c_str());
         std::cout << command_exe << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        system(command_exe.c_str());
         std::cout << clean << std::endl;
-        system(clean.c_str());
-    } else {
-        system(command.c_str());
-        system(command_exe.c_str());
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        system(clean.c_str());
+    }
+    system(command.c_str());
+    int status = getExitCode(system(command_exe.c_str()));
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
     }
 }
 
 void
 runWindows(bool is_verbose) {
+    if (manifestExists()) {
+        buildFromManifest("run", {});
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
 
     std::string command = "cmd.exe /c \""
-        + compiler
+        + Toolchain::get().getCompiler()
         + " /std:c++latest /EHsc /I\"%USERPROFILE%\\.config\\.cppc\" "
         "build.cpp /Febuild.exe\"";
     std::string command_exe = "cmd.exe /c \"build.exe run\"";
@@ -274,24 +586,48 @@ runWindows(bool is_verbose) {
         std::cout << command << std::endl;
         std::cout << command_exe << std::endl;
         std::cout << clean << std::endl;
-        system(command.c_str());
-        system(command_exe.c_str());
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        system(clean.c_str());
-    } else {
-        system(command.c_str());
-        system(command_exe.c_str());
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        system(clean.c_str());
+    }
+    system(command.c_str());
+    int status = getExitCode(system(command_exe.c_str()));
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
     }
 }
 
 void
-runWindowsTest(bool is_verbose) {
+runWindowsTest(bool is_verbose, std::vector<std::string> args) {
+    if (manifestExists()) {
+        buildFromManifest("test", args);
+        return;
+    }
+
     if (!buildFileExists()) {
         std::cout << "No build.cpp file exists." << std::endl;
         return;
     }
+
+    std::string command = "cmd.exe /c \""
+        + Toolchain::get().getCompiler()
+        + " /std:c++latest /EHsc /I\"%USERPROFILE%\\.config\\.cppc\" "
+        "build.cpp /Febuild.exe\"";
+    std::string command_exe = "cmd.exe /c \"build.exe test"
+        + quoteArgs(args) + "\"";
+    std::string clean = "del build.exe";
+
+    if (is_verbose) {
+        std::cout << command << std::endl;
+        std::cout << command_exe << std::endl;
+        std::cout << clean << std::endl;
+    }
+    system(command.c_str());
+    int status = getExitCode(system(command_exe.c_str()));
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    system(clean.c_str());
+    if (status != 0) {
+        std::exit(status);
+    }
 }
 
 void
@@ -341,7 +677,7 @@ createWindowsCompileCommands(std::string project_name) {
     file << "[" << std::endl;
     file << "  {" << std::endl;
     file << "    \"arguments\": [" << std::endl;
-    file << "      \"" + compiler_full_path + "\"," << std::endl;
+    file << "      \"" + Toolchain::get().getPath() + "\"," << std::endl;
     file << "      \"-c\"," << std::endl;
     file << "      \"-g\"," << std::endl;
     file << "      \"-Wall\"," << std::endl;
@@ -381,20 +717,88 @@ printHelp() {
         "Commands\n"
         "  build              run the build.cpp file to create an executable\n"
         "  run                build and run the project\n"
-        "  test               run tests for the project\n"
+        "  test               build and run the project's tests\n"
         "  new                create a new project with the name given\n"
+        "  size               build and break the binary down by section,\n"
+        "                     object file, symbol and template family\n"
+        "  bench              time builds of a generated project, prints JSON\n"
+        "  worker             compile preprocessed sources sent by other\n"
+        "                     cppc builds (set CPPC_WORKERS to use workers)\n"
+        "  toolchain          show the compiler in use (set CXX to choose one)\n"
+        "                     and the optional flags it supports\n"
         "\nArguments\n"
         "  <project name>     example: cppc new <project_name>\n"
-        "  -v                 verbose for build, run, and test commands\n";
+        "  -v                 verbose for build, run, and test commands\n"
+        "  --toml             with new, create a cppc.toml instead of build.cpp\n"
+        "  --affected         with test, only run tests whose inputs changed\n"
+        "                     since their last pass (or --since <git ref>)\n"
+        "  --explain          with test, print why each test was selected\n"
+        "  --profile          with run, build an optimized variant with frame\n"
+        "                     pointers, sample it with perf (or the cppc\n"
+        "                     sampler) and write folded stacks\n"
+        "  --top <n>          rows per table for size and --profile\n"
+        "                     (default 20)\n"
+        "  --diff <a> <b>     compare the sizes of two binaries\n"
+        "  --max-growth <n>   with --diff, fail when <b> grew by more than\n"
+        "                     <n> bytes\n"
+        "  --listen <addr>    worker socket, unix:/path or host:port\n"
+        "  --jobs <n>         parallel compiles for a worker\n";
     std::cout << message << std::endl;
 }
 
 void
-handleArgs(std::string cmd, std::string opt1) {
+printToolchain() {
+    Toolchain &toolchain = Toolchain::get();
+    if (toolchain.getPath() == "") {
+        std::cerr << "Error: compiler " << toolchain.getCompiler()
+                  << " was not found" << std::endl;
+        std::exit(1);
+    }
+
+    std::cout << "compiler  " << toolchain.getCompiler() << std::endl;
+    std::cout << "path      " << toolchain.getPath() << std::endl;
+    std::cout << "version   " << toolchain.getVersion() << std::endl;
+    std::cout << "identity  " << toolchain.getIdentity() << std::endl;
+    for (auto flag : Toolchain::getProbedFlags()) {
+        std::cout << (toolchain.supports(flag) ? "yes       " : "no        ")
+                  << flag << std::endl;
+    }
+}
+
+// cppc worker --listen <address> [--jobs n]
+void
+runWorker(std::vector<std::string> args) {
+    std::string address = "";
+    unsigned int jobs = std::thread::hardware_concurrency();
+
+    for (size_t i = 0; i + 1 < args.size(); i += 2) {
+        if (args[i] == "--listen") {
+            address = args[i + 1];
+        } else if (args[i] == "--jobs") {
+            jobs = parseCountArg("--jobs", args[i + 1], 1);
+        }
+    }
+
+    if (address == "") {
+        std::cerr << "Usage: cppc worker --listen <address> [--jobs n]"
+                  << std::endl;
+        std::exit(2);
+    }
+
+    RemoteWorker worker(address, jobs);
+    std::exit(worker.listen());
+}
+
+void
+handleArgs(
+    std::string cmd,
+    std::string opt1,
+    std::vector<std::string> args
+) {
     if (os == "linux") {
-        handleLinuxArgs(cmd, opt1);
+        handleLinuxArgs(cmd, opt1, args);
     } else if (os == "windows") {
-        handleWindowsArgs(cmd, opt1);
+        handleWindowsArgs(cmd, opt1, args);
     } else if (os == "macos") {
         handleMacosArgs(cmd, opt1);
     } else {
@@ -402,6 +806,31 @@ handleArgs(std::string cmd, std::string opt1) {
     }
 }
 
+std::string
+quoteArgs(std::vector<std::string> args) {
+    std::string quoted = "";
+    for (auto arg : args) {
+        quoted += " \"" + arg + "\"";
+    }
+
+    return quoted;
+}
+
+// what a command run with system() exited with, so cppc exits with the
+// status of the build.cpp driver
+int
+getExitCode(int status) {
+#ifdef _WIN32
+    return status;
+#else
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+
+    return 1;
+#endif
+}
+
 bool
 buildFileExists() {
     std::filesystem::path build_file = "build.cpp";
@@ -413,7 +842,7 @@ buildFileExists() {
 }
 
 void
-createProject(std::string project_name) {
+createProject(std::string project_name, bool manifest) {
     std::filesystem::path name = project_name;
     std::filesystem::path src = "src";
     std::filesystem::path dirs = name / src;
@@ -422,6 +851,16 @@ createProject(std::string project_name) {
     std::filesystem::path build_cpp = name / "build.cpp";
     createMainCpp(main_cpp);
 
+    if (manifest) {
+        createManifest(name / "cppc.toml");
+        if (os == "linux") {
+            createLinuxCompileCommands(project_name);
+        } else if (os == "windows") {
+            createWindowsCompileCommands(project_name);
+        }
+        return;
+    }
+
     if (os == "linux") {
         createLinuxBuildCpp(build_cpp);
         createLinuxCompileCommands(project_name);
@@ -431,6 +870,337 @@ createProject(std::string project_name) {
     }
 }
 
+bool
+manifestExists() {
+    return std::filesystem::exists("cppc.toml");
+}
+
+// runs the build engine from builder.h directly, nothing is compiled to
+// read the settings
+void
+buildFromManifest(std::string cmd, std::vector<std::string> args) {
+    std::vector<std::string> words = {"cppc", cmd};
+    words.insert(words.end(), args.begin(), args.end());
+    std::vector<char *> argv;
+    for (auto &w : words) {
+        argv.push_back(w.data());
+    }
+    argv.push_back(nullptr);
+
+    Builder builder(argv.size() - 1, argv.data());
+    parseManifest("cppc.toml", builder);
+    builder.build();
+}
+
+// cppc.toml is a flat subset of TOML, every key maps onto Options or a
+// Builder method. Projects that need more than this keep a build.cpp.
+void
+parseManifest(std::string path, Builder &builder) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open the file " << path << std::endl;
+        std::exit(1);
+    }
+
+    Options options{};
+    options.name = "app";
+    options.root_source_file = "./src/main.cpp";
+    options.version = Version::V23;
+    options.optimize = Optimize::Debug;
+    options.target = Targets::Linux;
+
+    std::map<std::string, Version> versions = {
+        {"11", Version::V11}, {"14", Version::V14}, {"17", Version::V17},
+        {"20", Version::V20}, {"23", Version::V23},
+    };
+    std::map<std::string, Debug> debugs = {
+        {"g", Debug::G}, {"wall", Debug::Wall},
+        {"wextra", Debug::Wextra}, {"pedantic", Debug::Pedantic},
+    };
+    std::map<std::string, Optimize> optimizes = {
+        {"debug", Optimize::Debug}, {"release", Optimize::Release},
+        {"embedded", Optimize::Embedded},
+    };
+    std::map<std::string, Targets> targets = {
+        {"linux", Targets::Linux}, {"windows", Targets::Windows},
+        {"macos", Targets::MacOS},
+    };
+    std::map<std::string, DebugInfo> debug_infos = {
+        {"full", DebugInfo::Full}, {"split", DebugInfo::Split},
+        {"split_packed", DebugInfo::SplitPacked},
+    };
+    std::map<std::string, DebugCompression> debug_compressions = {
+        {"none", DebugCompression::None}, {"zlib", DebugCompression::Zlib},
+        {"zstd", DebugCompression::Zstd},
+    };
+
+    std::vector<std::string> source_globs;
+    std::vector<std::string> source_excludes;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        int start_line = line_number;
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            std::cerr << "Error: " << path << ":" << line_number
+                      << ": expected key = value" << std::endl;
+            std::exit(1);
+        }
+
+        std::string key = line.substr(first, equals - first);
+        key = key.substr(0, key.find_last_not_of(" \t") + 1);
+        std::string raw = line.substr(equals + 1);
+
+        // arrays may span several lines
+        while (isOpenManifestArray(raw) && std::getline(file, line)) {
+            line_number++;
+            raw += "\n" + line;
+        }
+
+        std::vector<std::string> values = parseManifestValue(
+            path, start_line, raw
+        );
+        auto lookup = [&](auto &table, std::string value) {
+            std::string lower = value;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            if (lower.starts_with("c++")) {
+                lower = lower.substr(3);
+            }
+            if (!table.contains(lower)) {
+                std::cerr << "Error: " << path << ":" << start_line
+                          << ": unknown " << key << " \"" << value << "\""
+                          << std::endl;
+                std::exit(1);
+            }
+            return table.at(lower);
+        };
+        auto single = [&]() {
+            if (values.empty()) {
+                std::cerr << "Error: " << path << ":" << start_line << ": "
+                          << key << " needs a value, not an empty list"
+                          << std::endl;
+                std::exit(1);
+            }
+            return values[0];
+        };
+        auto boolean = [&]() {
+            std::string value = single();
+            if (value != "true" && value != "false") {
+                std::cerr << "Error: " << path << ":" << start_line << ": "
+                          << key << " expects true or false, got \""
+                          << value << "\"" << std::endl;
+                std::exit(1);
+            }
+            return value == "true";
+        };
+        auto flag = [&](std::string value, std::string prefix) {
+            return value.starts_with("-") || value.starts_with("/")
+                ? value : prefix + value;
+        };
+
+        if (key == "name") {
+            options.name = single();
+        } else if (key == "root_source_file") {
+            options.root_source_file = single();
+        } else if (key == "version") {
+            options.version = lookup(versions, single());
+        } else if (key == "debug") {
+            for (auto v : values) {
+                options.debug.push_back(lookup(debugs, v));
+            }
+        } else if (key == "optimize") {
+            options.optimize = lookup(optimizes, single());
+        } else if (key == "target" || key == "targets") {
+            for (auto v : values) {
+                options.targets.insert(lookup(targets, v));
+            }
+        } else if (key == "gc_sections") {
+            options.gc_sections = boolean();
+        } else if (key == "icf") {
+            options.icf = boolean();
+        } else if (key == "lto") {
+            options.lto = boolean();
+        } else if (key == "reproducible") {
+            options.reproducible = boolean();
+        } else if (key == "debug_info") {
+            options.debug_info = lookup(debug_infos, single());
+        } else if (key == "debug_compression") {
+            options.debug_compression = lookup(debug_compressions, single());
+        } else if (key == "component_build") {
+            if (boolean()) {
+                builder.enableComponentBuild();
+            }
+        } else if (key == "instrumentation") {
+            if (boolean()) {
+                builder.enableInstrumentation();
+            }
+        } else if (key == "include_dirs") {
+            for (auto v : values) {
+                builder.addIncludeDir(flag(v, "-I"));
+            }
+        } else if (key == "sources") {
+            for (auto v : values) {
+                if (v.find_first_of("*?") != std::string::npos) {
+                    source_globs.push_back(v);
+                } else {
+                    builder.addSourceFile(v);
+                }
+            }
+        } else if (key == "exclude_sources") {
+            for (auto v : values) {
+                source_excludes.push_back(v);
+            }
+        } else if (key == "tests") {
+            for (auto v : values) {
+                builder.addTest(v);
+            }
+        } else if (key == "lib_dirs") {
+            for (auto v : values) {
+                builder.addLibDir(flag(v, "-L"));
+            }
+        } else if (key == "libraries") {
+            for (auto v : values) {
+                builder.addLibrary(flag(v, "-l"));
+            }
+        } else {
+            std::cerr << "Error: " << path << ":" << start_line
+                      << ": unknown key " << key
+                      << " (use a build.cpp for custom build logic)"
+                      << std::endl;
+            std::exit(1);
+        }
+    }
+
+    // globs run after the whole file is read so exclude_sources can come
+    // before or after sources
+    for (auto glob : source_globs) {
+        builder.addSources(glob, source_excludes);
+    }
+
+    builder.setOptions(options);
+}
+
+// a quoted string, a bare word (true, 23) or an array of either, [] is an
+// empty list
+std::vector<std::string>
+parseManifestValue(std::string path, int line_number, std::string value) {
+    std::vector<std::string> values;
+    size_t i = 0;
+    bool in_array = false;
+    bool has_array = false;
+
+    auto fail = [&](std::string message) {
+        std::cerr << "Error: " << path << ":" << line_number << ": "
+                  << message << std::endl;
+        std::exit(1);
+    };
+
+    while (i < value.size()) {
+        char c = value[i];
+        if (c == ' ' || c == '\t' || c == '\n' || c == ',') {
+            i++;
+        } else if (c == '#') {
+            i = value.find('\n', i);
+            if (i == std::string::npos) {
+                break;
+            }
+        } else if (c == '[' && !in_array) {
+            in_array = true;
+            has_array = true;
+            i++;
+        } else if (c == ']' && in_array) {
+            in_array = false;
+            i++;
+        } else if (c == '"' || c == '\'') {
+            std::string text = "";
+            i++;
+            while (i < value.size() && value[i] != c) {
+                if (c == '"' && value[i] == '\\' && i + 1 < value.size()) {
+                    i++;
+                }
+                text += value[i++];
+            }
+            if (i >= value.size()) {
+                fail("unterminated string");
+            }
+            values.push_back(text);
+            i++;
+        } else {
+            size_t end = value.find_first_of(" \t\n,]#", i);
+            values.push_back(value.substr(i, end - i));
+            i = end == std::string::npos ? value.size() : end;
+        }
+    }
+
+    if (in_array) {
+        fail("unterminated array");
+    }
+    if (values.empty() && !has_array) {
+        fail("missing value");
+    }
+
+    return values;
+}
+
+// whether <value> opens an array it does not close yet, brackets inside
+// strings and comments do not count
+bool
+isOpenManifestArray(std::string value) {
+    bool open = false;
+    size_t i = 0;
+    while (i < value.size()) {
+        char c = value[i];
+        if (c == '#') {
+            i = value.find('\n', i);
+            if (i == std::string::npos) {
+                break;
+            }
+        } else if (c == '"' || c == '\'') {
+            i++;
+            while (i < value.size() && value[i] != c) {
+                if (c == '"' && value[i] == '\\') {
+                    i++;
+                }
+                i++;
+            }
+            i++;
+        } else {
+            if (c == '[') {
+                open = true;
+            } else if (c == ']') {
+                open = false;
+            }
+            i++;
+        }
+    }
+
+    return open;
+}
+
+void
+createManifest(std::filesystem::path manifest) {
+    std::ofstream file(manifest);
+    file << "name = \"app\"" << std::endl;
+    file << "root_source_file = \"./src/main.cpp\"" << std::endl;
+    file << "version = \"c++23\"" << std::endl;
+    file << "debug = [\"g\", \"wall\", \"wextra\", \"pedantic\"]" << std::endl;
+    file << "optimize = \"debug\"" << std::endl;
+    file << "targets = [\"" << os << "\"]" << std::endl;
+    file << std::endl;
+    file << "# include_dirs = [\"./include\"]" << std::endl;
+    file << "# sources = [\"./src/person.cpp\"]" << std::endl;
+    file << "# lib_dirs = []" << std::endl;
+    file << "# libraries = []" << std::endl;
+    file.close();
+}
+
 void
 createMainCpp(std::filesystem::path main_cpp) {
     std::ofstream file(main_cpp);
@@ -450,25 +1220,24 @@ main(int argc, char *argv[]) {
     std::string tool_name = "";
     std::string command = "";
     std::string option1 = "";
+    std::vector<std::string> args;
 
     if (argc == 1) {
         tool_name = argv[0];
     } else if (argc == 2) {
         tool_name = argv[0];
         command = argv[1];
-    } else if (argc == 3) {
-        tool_name = argv[0];
-        command = argv[1];
-        option1 = argv[2];
-    } else if (argc == 3) {
+    } else {
         tool_name = argv[0];
         command = argv[1];
         option1 = argv[2];
-    } else {
-        printHelp();
     }
 
-    handleArgs(command, option1);
+    for (int i = 2; i < argc; i++) {
+        args.push_back(argv[i]);
+    }
+
+    handleArgs(command, option1, args);
 
     return 0;
 }
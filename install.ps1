@@ -9,10 +9,12 @@ try {
     exit 1
 }
 
-Write-Host "Adding cppc.exe binary and builder.h to $installDir"
+Write-Host "Adding cppc.exe binary, builder.h, remote.h and instrument.h to $installDir"
 try {
     Copy-Item -Path "cppc.exe" -Destination $installDir -Force -ErrorAction Stop
     Copy-Item -Path "builder.h" -Destination $installDir -Force -ErrorAction Stop
+    Copy-Item -Path "remote.h" -Destination $installDir -Force -ErrorAction Stop
+    Copy-Item -Path "instrument.h" -Destination $installDir -Force -ErrorAction Stop
 } catch {
     Write-Error "Error copying files: $($_.Exception.Message)"
     exit 1
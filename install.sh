@@ -9,9 +9,12 @@ make
 echo "Creating install directory: $INSTALL_DIR"
 mkdir -p "$INSTALL_DIR"
 
-echo "Adding cppc binary and builder.h to $INSTALL_DIR"
+echo "Adding cppc binary, builder.h, remote.h, instrument.h and profiler.cpp to $INSTALL_DIR"
 cp cppc "$INSTALL_DIR"
 cp builder.h "$INSTALL_DIR"
+cp remote.h "$INSTALL_DIR"
+cp instrument.h "$INSTALL_DIR"
+cp profiler.cpp "$INSTALL_DIR"
 
 if ! grep -Fxq "$LINE" "$ZSHRC"; then
   echo "$LINE" >> "$ZSHRC"
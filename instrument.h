@@ -0,0 +1,298 @@
+#pragma once
+
+// Hot path instrumentation for applications built with cppc.
+//
+//     #include "instrument.h"
+//
+//     void handleRequest(Request &request) {
+//         CPPC_ZONE("handleRequest");
+//         {
+//             CPPC_ZONE("parse");
+//             ...
+//         }
+//         CPPC_COUNTER("queue_depth", queue.size());
+//     }
+//
+// With builder.enableInstrumentation() the macros record into a ring buffer
+// owned by the calling thread, so recording takes no lock, and the most
+// recent events of every thread are written as Chrome trace JSON when the
+// program exits. The file is cppc-trace.json, or CPPC_TRACE_FILE when that
+// is set, and opens in chrome://tracing or ui.perfetto.dev. Without it the
+// macros expand to nothing. Zone and counter names must be string literals
+// (or otherwise outlive the program), only the pointer is stored.
+
+///////////////////////////////////////////////////////////////////////////////
+// prepocessor statements
+///////////////////////////////////////////////////////////////////////////////
+#define CPPC_CONCAT_INNER(a, b) a##b
+#define CPPC_CONCAT(a, b) CPPC_CONCAT_INNER(a, b)
+
+#ifndef CPPC_INSTRUMENT
+
+#define CPPC_ZONE(name) ((void)0)
+#define CPPC_FUNCTION_ZONE() ((void)0)
+#define CPPC_COUNTER(name, value) ((void)0)
+
+#else
+
+#define CPPC_ZONE(name) \
+    cppc::instrument::Zone CPPC_CONCAT(cppc_zone_, __LINE__)(name)
+#define CPPC_FUNCTION_ZONE() CPPC_ZONE(__func__)
+#define CPPC_COUNTER(name, value) \
+    cppc::instrument::counter(name, static_cast<double>(value))
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+    #define CPPC_INSTRUMENT_RDTSC
+#endif
+
+namespace cppc {
+namespace instrument {
+
+///////////////////////////////////////////////////////////////////////////////
+// structs
+///////////////////////////////////////////////////////////////////////////////
+struct Event {
+    const char *name;
+    uint64_t start;
+    // the end tick for a zone, unused for a counter
+    uint64_t end;
+    double value;
+    bool is_counter;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// classes
+///////////////////////////////////////////////////////////////////////////////
+// written only by its thread, read by write() once the program exits. When
+// it is full the oldest events are overwritten.
+class RingBuffer {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        RingBuffer(uint32_t thread_id) : thread_id(thread_id), head(0) {
+        }
+
+        void push(const Event &event) {
+            uint64_t index = head.load(std::memory_order_relaxed);
+            events[index & (capacity - 1)] = event;
+            head.store(index + 1, std::memory_order_release);
+        }
+
+        uint32_t getThreadId() {
+            return thread_id;
+        }
+
+        // oldest first
+        std::vector<Event> getEvents() {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > capacity ? end - capacity : 0;
+            std::vector<Event> list;
+            list.reserve(end - begin);
+            for (uint64_t i = begin; i < end; i++) {
+                list.push_back(events[i & (capacity - 1)]);
+            }
+
+            return list;
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        static const uint64_t capacity = 1 << 16;
+
+        uint32_t thread_id;
+        std::atomic<uint64_t> head;
+        Event events[capacity];
+};
+
+class Registry {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        // never destroyed, so zones in static destructors are still safe
+        static Registry &get() {
+            static Registry *instance = createInstance();
+            return *instance;
+        }
+
+        static uint64_t now() {
+#ifdef CPPC_INSTRUMENT_RDTSC
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+            ).count();
+#endif
+        }
+
+        RingBuffer &getThreadBuffer() {
+            thread_local RingBuffer *buffer = nullptr;
+            if (buffer == nullptr) {
+                std::lock_guard<std::mutex> lock(mutex);
+                buffers.emplace_back(new RingBuffer(buffers.size() + 1));
+                buffer = buffers.back().get();
+            }
+
+            return *buffer;
+        }
+
+        // the events recorded so far, also called at exit
+        void write(std::string path) {
+            double us_per_tick = getMicrosecondsPerTick();
+            FILE *file = std::fopen(path.c_str(), "w");
+            if (file == nullptr) {
+                std::fprintf(stderr, "cppc instrument: cannot write %s\n",
+                             path.c_str());
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+            bool first = true;
+            for (auto &buffer : buffers) {
+                for (auto &event : buffer->getEvents()) {
+                    std::string name = escape(event.name);
+                    double ts = (int64_t)(event.start - origin) * us_per_tick;
+                    std::fprintf(file, first ? "\n" : ",\n");
+                    first = false;
+                    if (event.is_counter) {
+                        std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\","
+                                     "\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+                                     "\"args\":{\"value\":%.17g}}",
+                                     name.c_str(), ts, buffer->getThreadId(),
+                                     event.value);
+                    } else {
+                        double dur = (event.end - event.start) * us_per_tick;
+                        std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\","
+                                     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,"
+                                     "\"tid\":%u}",
+                                     name.c_str(), ts, dur,
+                                     buffer->getThreadId());
+                    }
+                }
+            }
+            std::fprintf(file, "\n]}\n");
+            std::fclose(file);
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        std::mutex mutex;
+        std::vector<std::unique_ptr<RingBuffer>> buffers;
+        uint64_t origin;
+        std::chrono::steady_clock::time_point origin_time;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        Registry() {
+            origin = now();
+            origin_time = std::chrono::steady_clock::now();
+        }
+
+        static Registry *createInstance() {
+            Registry *registry = new Registry();
+            std::atexit([]() {
+                const char *path = std::getenv("CPPC_TRACE_FILE");
+                Registry::get().write(path == nullptr ? "cppc-trace.json" : path);
+            });
+
+            return registry;
+        }
+
+        // rdtsc ticks at a fixed rate on every x86-64 cpu from the last
+        // decade, the rate is measured against steady_clock since startup
+        double getMicrosecondsPerTick() {
+#ifdef CPPC_INSTRUMENT_RDTSC
+            uint64_t ticks = now() - origin;
+            double us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - origin_time
+            ).count();
+
+            return ticks == 0 ? 0.0 : us / ticks;
+#else
+            return 0.001;
+#endif
+        }
+
+        static std::string escape(const char *name) {
+            std::string escaped = "";
+            for (const char *c = name; *c != '\0'; c++) {
+                if (*c == '"' || *c == '\\') {
+                    escaped += '\\';
+                }
+                if ((unsigned char)*c >= 0x20) {
+                    escaped += *c;
+                }
+            }
+
+            return escaped;
+        }
+};
+
+// records the time between its construction and the end of the scope
+class Zone {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        // the buffer is looked up first so the lookup is not timed
+        explicit Zone(const char *name)
+            : buffer(Registry::get().getThreadBuffer()), name(name),
+              start(Registry::now()) {
+        }
+
+        ~Zone() {
+            uint64_t end = Registry::now();
+            buffer.push(Event{name, start, end, 0.0, false});
+        }
+
+        Zone(const Zone &) = delete;
+        Zone &operator=(const Zone &) = delete;
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        RingBuffer &buffer;
+        const char *name;
+        uint64_t start;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// functions
+///////////////////////////////////////////////////////////////////////////////
+inline void counter(const char *name, double value) {
+    RingBuffer &buffer = Registry::get().getThreadBuffer();
+    uint64_t now = Registry::now();
+    buffer.push(Event{name, now, now, value, true});
+}
+
+inline void write(std::string path) {
+    Registry::get().write(path);
+}
+
+} // namespace instrument
+} // namespace cppc
+
+#endif
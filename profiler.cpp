@@ -0,0 +1,178 @@
+// The sampling profiler behind "cppc run --profile" when perf is not
+// installed. cppc compiles this file into a shared library and loads it into
+// the application with LD_PRELOAD. SIGPROF fires every millisecond of CPU
+// time, the handler stores the call stack in a preallocated buffer, and the
+// stacks are written to CPPC_PROFILE_OUT when the application exits
+// normally. One sample is one line of tab separated frames, leaf first. A
+// frame is a demangled name when the dynamic symbol table has one, otherwise
+// "?<module>@<address>" for cppc to resolve with addr2line.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// classes
+///////////////////////////////////////////////////////////////////////////////
+class SamplingProfiler {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        SamplingProfiler() {
+            const char *out = std::getenv("CPPC_PROFILE_OUT");
+            if (out == nullptr) {
+                return;
+            }
+            out_path = out;
+
+            // processes the application starts are not profiled
+            unsetenv("LD_PRELOAD");
+            unsetenv("CPPC_PROFILE_OUT");
+
+            // the first backtrace() loads the unwinder, which allocates and
+            // so must not happen inside the signal handler
+            void *warm_up[4];
+            backtrace(warm_up, 4);
+
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = handleSignal;
+            action.sa_flags = SA_RESTART | SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGPROF, &action, nullptr);
+
+            itimerval timer;
+            timer.it_interval.tv_sec = 0;
+            timer.it_interval.tv_usec = 1000;
+            timer.it_value = timer.it_interval;
+            setitimer(ITIMER_PROF, &timer, nullptr);
+        }
+
+        ~SamplingProfiler() {
+            if (out_path == "") {
+                return;
+            }
+
+            itimerval timer;
+            std::memset(&timer, 0, sizeof(timer));
+            setitimer(ITIMER_PROF, &timer, nullptr);
+            signal(SIGPROF, SIG_IGN);
+
+            write();
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        static constexpr size_t max_samples = 1 << 16;
+        static constexpr int max_depth = 64;
+        // the handler's own frame and the signal trampoline
+        static constexpr int skip_frames = 2;
+
+        static inline void *frames[max_samples][max_depth];
+        static inline int depths[max_samples];
+        static inline std::atomic<size_t> next{0};
+
+        std::string out_path = "";
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        static void handleSignal(int, siginfo_t *, void *) {
+            int saved_errno = errno;
+            size_t index = next.fetch_add(1, std::memory_order_relaxed);
+            if (index < max_samples) {
+                depths[index] = backtrace(frames[index], max_depth);
+            }
+            errno = saved_errno;
+        }
+
+        void write() {
+            FILE *file = std::fopen(out_path.c_str(), "w");
+            if (file == nullptr) {
+                return;
+            }
+
+            std::map<void *, std::string> names;
+            size_t samples = std::min(next.load(), max_samples);
+            for (size_t i = 0; i < samples; i++) {
+                for (int d = skip_frames; d < depths[i]; d++) {
+                    // return addresses point after the call instruction
+                    char *address = (char *)frames[i][d];
+                    if (d > skip_frames) {
+                        address--;
+                    }
+
+                    auto found = names.find(address);
+                    if (found == names.end()) {
+                        found = names.emplace(address, describe(address)).first;
+                    }
+                    std::fprintf(file, d > skip_frames ? "\t%s" : "%s",
+                                 found->second.c_str());
+                }
+                std::fprintf(file, "\n");
+            }
+            if (next.load() > max_samples) {
+                std::fprintf(stderr, "cppc profiler: kept the first %zu of "
+                             "%zu samples\n", max_samples, next.load());
+            }
+
+            std::fclose(file);
+        }
+
+        std::string describe(char *address) {
+            Dl_info info;
+            if (dladdr(address, &info) == 0 || info.dli_fname == nullptr) {
+                return "[unknown]";
+            }
+
+            if (info.dli_sname != nullptr) {
+                int status = 0;
+                char *demangled = abi::__cxa_demangle(
+                    info.dli_sname, nullptr, nullptr, &status
+                );
+                std::string name = status == 0 ? demangled : info.dli_sname;
+                std::free(demangled);
+                return name;
+            }
+
+            // addr2line wants the link time address, which for a position
+            // independent object is the offset from where it was loaded
+            char *base = (char *)info.dli_fbase;
+            uintptr_t offset = (uintptr_t)address;
+            if (((ElfW(Ehdr) *)base)->e_type != ET_EXEC) {
+                offset -= (uintptr_t)base;
+            }
+
+            std::string module = info.dli_fname;
+            if (module == "" || module.find('/') == std::string::npos) {
+                char exe[4096];
+                ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+                if (n > 0) {
+                    module = std::string(exe, n);
+                }
+            }
+
+            char hex[32];
+            std::snprintf(hex, sizeof(hex), "%lx", (unsigned long)offset);
+            return "?" + module + "@" + hex;
+        }
+};
+
+static SamplingProfiler profiler;
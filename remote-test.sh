@@ -0,0 +1,118 @@
+#!/bin/sh
+
+# End to end test of cppc worker on one machine. A stand-in worker listens
+# on a unix socket and a small cppc.toml project is built through it:
+#   - objects are compiled by the worker
+#   - a compile error on the worker fails the build without a local retry
+#   - once the worker is gone the build falls back to compiling locally
+#
+# usage: ./remote-test.sh [cppc binary] [scratch directory]
+
+CPPC="$(realpath "${1:-./cppc}")"
+DIR="$(realpath -m "${2:-cppc-remote-test}")"
+SOCKET="$DIR/worker.sock"
+REAL_CXX="$(command -v g++)"
+FAILED=0
+
+# runs cppc with a g++ that logs its local compiles, the worker keeps the
+# real one
+build() {
+    rm -f "$DIR/local.log"
+    PATH="$DIR/bin:$PATH" CPPC_WORKERS="unix:$SOCKET" "$CPPC" build \
+        > "$DIR/$1.log" 2>&1
+}
+
+compiled_locally() {
+    grep -qE -- '(^| )-c ' "$DIR/local.log" 2> /dev/null
+}
+
+check() {
+    if [ "$1" = 0 ]; then
+        echo "ok: $2"
+    else
+        echo "FAILED: $2"
+        FAILED=1
+    fi
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR/app/src" "$DIR/bin"
+cd "$DIR/app" || exit 1
+
+cat > "$DIR/bin/g++" <<EOF
+#!/bin/sh
+echo "\$*" >> "$DIR/local.log"
+exec "$REAL_CXX" "\$@"
+EOF
+chmod +x "$DIR/bin/g++"
+
+cat > cppc.toml <<EOF
+name = "app"
+root_source_file = "./src/main.cpp"
+version = "c++20"
+debug = ["g", "wall"]
+optimize = "debug"
+targets = ["linux"]
+sources = ["./src/lib.cpp"]
+EOF
+
+cat > src/main.cpp <<EOF
+#include <iostream>
+
+int answer();
+
+int main() {
+    std::cout << answer() << std::endl;
+    return 0;
+}
+EOF
+
+echo 'int answer() { return 42; }' > src/lib.cpp
+
+"$CPPC" worker --listen "unix:$SOCKET" --jobs 2 > "$DIR/worker.log" 2>&1 &
+WORKER=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$SOCKET" ] && break
+    sleep 0.2
+done
+
+# remote build
+build build
+check $? "build through the worker"
+[ "$(grep -c 'exited with 0' "$DIR/worker.log")" -ge 2 ]
+check $? "the worker compiled both sources"
+! compiled_locally
+check $? "nothing was compiled locally"
+[ "$(./app 2>/dev/null)" = "42" ]
+check $? "the program built by the worker runs"
+
+# compile error on the worker
+echo 'int answer() { return undefined_name; }' > src/lib.cpp
+build error
+[ $? != 0 ]
+check $? "a compile error on the worker fails the build"
+grep -q 'exited with 1' "$DIR/worker.log"
+check $? "the worker reported the compile error"
+grep -q "error: 'undefined_name'" "$DIR/error.log"
+check $? "the worker's diagnostics are shown"
+! compiled_locally
+check $? "the failed source is not compiled again locally"
+
+# local fallback
+kill $WORKER
+wait $WORKER 2> /dev/null
+echo 'int answer() { return 7; }' > src/lib.cpp
+build fallback
+check $? "build without a live worker"
+grep -q 'Warning: worker' "$DIR/fallback.log"
+check $? "the dead worker is reported"
+compiled_locally
+check $? "the source was compiled locally"
+[ "$(./app 2>/dev/null)" = "7" ]
+check $? "the program built locally runs"
+
+if [ $FAILED != 0 ]; then
+    echo "logs are in $DIR"
+fi
+
+exit $FAILED
@@ -0,0 +1,719 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <semaphore>
+#include <algorithm>
+#include <sstream>
+#include <map>
+#include <set>
+#include <cstdio>
+
+#ifndef _WIN32
+    #include <netdb.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// protocol
+///////////////////////////////////////////////////////////////////////////////
+// Every message is a list of fields, a field is its length in decimal, a
+// newline and then that many bytes.
+//
+// request:  "CPPC2", compiler, compiler version, argument count,
+//           arguments..., preprocessed source
+// response: exit status, object file, diagnostics
+//
+// The exit status is "refused" when the worker will not run the request,
+// the client then compiles locally instead.
+//
+// The worker runs the compiler without a shell. The compiler is reduced by
+// RemoteSocket::getWorkerCompiler() to one of
+// RemoteSocket::allowedCompilers() found on the worker's own PATH, and its
+// --version has to match the one the client sent so workers build the
+// same objects as a local compile. Only the arguments
+// RemoteSocket::isAllowedArgument() accepts are passed. Fields longer than
+// RemoteSocket::max_field are dropped. It should still only listen on
+// sockets reachable by trusted machines.
+
+///////////////////////////////////////////////////////////////////////////////
+// classes
+///////////////////////////////////////////////////////////////////////////////
+class RemoteSocket {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public members
+        ///////////////////////////////////////////////////////////////////////
+        // a preprocessed source or an object file
+        static const size_t max_field = 256 * 1024 * 1024;
+        // the magic, the compiler, the argument count and the arguments
+        static const size_t max_short_field = 4096;
+
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        static std::vector<std::string> allowedCompilers() {
+            return {"g++", "clang++", "x86_64-w64-mingw32-g++"};
+        }
+
+        // the compiler a worker runs for the command a build compiles with
+        // (CXX), or "" when workers cannot run it. ccache and sccache are
+        // dropped, a path is reduced to its file name so the worker runs
+        // its own copy, and version suffixes such as g++-13 are kept.
+        static std::string getWorkerCompiler(std::string compiler) {
+            std::istringstream words(compiler);
+            std::vector<std::string> names;
+            std::string word;
+            while (words >> word) {
+                names.push_back(word.substr(word.find_last_of("/\\") + 1));
+            }
+
+            size_t i = 0;
+            while (i < names.size()
+                   && (names[i] == "ccache" || names[i] == "sccache")) {
+                i++;
+            }
+            // anything after the compiler would change the object
+            if (i + 1 != names.size()) {
+                return "";
+            }
+
+            std::string name = names[i];
+            for (auto allowed : allowedCompilers()) {
+                if (name == allowed) {
+                    return name;
+                }
+                std::string suffix = name.substr(
+                    std::min(name.size(), allowed.size() + 1)
+                );
+                if (name.starts_with(allowed + "-") && suffix != ""
+                    && suffix.find_first_not_of("0123456789.")
+                       == std::string::npos) {
+                    return name;
+                }
+            }
+
+            return "";
+        }
+
+        // only the codegen flags Builder sends for a preprocessed source.
+        // Options such as -wrapper, -fplugin=, -specs=, -B or @file make
+        // the compiler load or run other programs, so anything not listed
+        // here is refused.
+        static bool isAllowedArgument(std::string arg) {
+            std::vector<std::string> flags = {
+                "-g", "-Wall", "-Wextra", "-pedantic", "-flto", "-fPIC",
+                "-fno-omit-frame-pointer", "-ffunction-sections",
+                "-fdata-sections",
+            };
+            std::vector<std::string> prefixes = {
+                "-O", "-std=", "-fvisibility=", "-ffile-prefix-map=",
+                "-frandom-seed=", "-gz=",
+            };
+
+            if (std::find(flags.begin(), flags.end(), arg) != flags.end()) {
+                return true;
+            }
+            for (auto &prefix : prefixes) {
+                if (arg.starts_with(prefix)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+#ifndef _WIN32
+        // "unix:/path", a path containing a slash, or "host:port"
+        static int connectTo(std::string address) {
+            if (isUnixAddress(address)) {
+                sockaddr_un addr = getUnixAddress(address);
+                int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    return -1;
+                }
+                if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+                    close(fd);
+                    return -1;
+                }
+
+                return fd;
+            }
+
+            addrinfo *result = resolve(address, false);
+            if (result == nullptr) {
+                return -1;
+            }
+
+            int fd = -1;
+            for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+                fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (fd < 0) {
+                    continue;
+                }
+                if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                    break;
+                }
+                close(fd);
+                fd = -1;
+            }
+            freeaddrinfo(result);
+
+            return fd;
+        }
+
+        static int listenOn(std::string address) {
+            int fd = -1;
+
+            if (isUnixAddress(address)) {
+                sockaddr_un addr = getUnixAddress(address);
+                unlink(addr.sun_path);
+                fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+                    return -1;
+                }
+            } else {
+                addrinfo *result = resolve(address, true);
+                if (result == nullptr) {
+                    return -1;
+                }
+
+                for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+                    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                    if (fd < 0) {
+                        continue;
+                    }
+                    int yes = 1;
+                    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+                    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                        break;
+                    }
+                    close(fd);
+                    fd = -1;
+                }
+                freeaddrinfo(result);
+            }
+
+            if (fd < 0 || listen(fd, 64) != 0) {
+                return -1;
+            }
+
+            return fd;
+        }
+
+        static bool sendField(int fd, std::string value) {
+            std::string header = std::to_string(value.size()) + "\n";
+            return writeAll(fd, header) && writeAll(fd, value);
+        }
+
+        static bool readField(
+            int fd,
+            std::string &value,
+            size_t limit = max_field
+        ) {
+            std::string header = "";
+            char c = 0;
+            while (true) {
+                if (read(fd, &c, 1) != 1) {
+                    return false;
+                }
+                if (c == '\n') {
+                    break;
+                }
+                if (c < '0' || c > '9' || header.size() > 12) {
+                    return false;
+                }
+                header += c;
+            }
+            if (header == "") {
+                return false;
+            }
+
+            size_t size = std::stoull(header);
+            if (size > limit) {
+                return false;
+            }
+
+            value.resize(size);
+            size_t done = 0;
+            while (done < value.size()) {
+                ssize_t n = read(fd, value.data() + done, value.size() - done);
+                if (n <= 0) {
+                    return false;
+                }
+                done += n;
+            }
+
+            return true;
+        }
+#endif
+
+        static std::string readFile(std::filesystem::path path) {
+            std::ifstream file(path, std::ios::binary);
+            return std::string(
+                (std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>()
+            );
+        }
+
+        static bool writeFile(std::filesystem::path path, std::string data) {
+            std::ofstream file(path, std::ios::binary | std::ios::out);
+            file << data;
+            return file.good();
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+        static bool isUnixAddress(std::string address) {
+            return address.starts_with("unix:")
+                || address.find('/') != std::string::npos;
+        }
+
+        static sockaddr_un getUnixAddress(std::string address) {
+            if (address.starts_with("unix:")) {
+                address = address.substr(5);
+            }
+
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            address.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+            return addr;
+        }
+
+        static addrinfo *resolve(std::string address, bool passive) {
+            size_t colon = address.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Error: worker address " << address
+                          << " needs a port" << std::endl;
+                return nullptr;
+            }
+
+            std::string host = address.substr(0, colon);
+            std::string port = address.substr(colon + 1);
+            addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+            addrinfo *result = nullptr;
+            if (getaddrinfo(host == "" ? nullptr : host.c_str(),
+                            port.c_str(), &hints, &result) != 0) {
+                return nullptr;
+            }
+
+            return result;
+        }
+
+        static bool writeAll(int fd, std::string data) {
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t n = send(fd, data.data() + done, data.size() - done,
+                                 MSG_NOSIGNAL);
+                if (n <= 0) {
+                    return false;
+                }
+                done += n;
+            }
+
+            return true;
+        }
+#endif
+};
+
+class RemoteWorker {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        RemoteWorker(std::string address, unsigned int jobs)
+            : slots(jobs == 0 ? 1 : jobs) {
+            this->address = address;
+        }
+
+        // serves compile requests until the process is killed
+        int listen() {
+#ifdef _WIN32
+            std::cerr << "Error: cppc worker is not supported on Windows yet"
+                      << std::endl;
+            return 1;
+#else
+            int server = RemoteSocket::listenOn(address);
+            if (server < 0) {
+                std::cerr << "Error: could not listen on " << address
+                          << std::endl;
+                return 1;
+            }
+
+            std::cout << "cppc worker listening on " << address << std::endl;
+            while (true) {
+                int client = accept(server, nullptr, nullptr);
+                if (client < 0) {
+                    continue;
+                }
+
+                std::thread([this, client]() {
+                    slots.acquire();
+                    handle(client);
+                    slots.release();
+                    close(client);
+                }).detach();
+            }
+#endif
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        std::string address;
+        std::counting_semaphore<> slots;
+        std::atomic<unsigned long> counter = 0;
+        std::map<std::string, std::string> versions;
+        std::mutex versions_mutex;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+        void handle(int client) {
+            std::string magic;
+            std::string compiler;
+            std::string version;
+            std::string count;
+            size_t limit = RemoteSocket::max_short_field;
+            if (!RemoteSocket::readField(client, magic, limit)
+                || magic != "CPPC2"
+                || !RemoteSocket::readField(client, compiler, limit)
+                || !RemoteSocket::readField(client, version, limit)
+                || !RemoteSocket::readField(client, count, limit)
+                || count == "" || count.size() > 4
+                || count.find_first_not_of("0123456789") != std::string::npos) {
+                return;
+            }
+
+            std::vector<std::string> args;
+            for (unsigned long i = 0; i < std::stoul(count); i++) {
+                std::string arg;
+                if (!RemoteSocket::readField(client, arg, limit)) {
+                    return;
+                }
+                args.push_back(arg);
+            }
+
+            std::string source;
+            if (!RemoteSocket::readField(client, source)) {
+                return;
+            }
+
+            std::string name = RemoteSocket::getWorkerCompiler(compiler);
+            if (name == "") {
+                refuse(client, "compiler " + compiler + " is not allowed");
+                return;
+            }
+            std::string worker_version = getVersion(name);
+            if (worker_version == "") {
+                refuse(client, "could not run " + name);
+                return;
+            }
+            if (worker_version != version) {
+                refuse(client, "the worker's " + name + " is " + worker_version
+                       + ", the build uses " + version);
+                return;
+            }
+            for (auto &arg : args) {
+                if (!RemoteSocket::isAllowedArgument(arg)) {
+                    refuse(client, "argument " + arg + " is not allowed");
+                    return;
+                }
+            }
+
+            std::filesystem::path dir = std::filesystem::temp_directory_path()
+                / ("cppc-worker-" + std::to_string(getpid()) + "-"
+                   + std::to_string(counter++));
+            std::filesystem::create_directories(dir);
+
+            RemoteSocket::writeFile(dir / "in.ii", source);
+            int status = compile(name, args, dir);
+            std::cout << "cppc worker: " << name << " exited with "
+                      << status << std::endl;
+
+            std::error_code ec;
+            if (status == 127) {
+                refuse(client, "could not run " + name);
+                std::filesystem::remove_all(dir, ec);
+                return;
+            }
+
+            RemoteSocket::sendField(client, std::to_string(status));
+            RemoteSocket::sendField(client, status == 0
+                ? RemoteSocket::readFile(dir / "out.o") : "");
+            RemoteSocket::sendField(
+                client, RemoteSocket::readFile(dir / "diagnostics.txt")
+            );
+
+            std::filesystem::remove_all(dir, ec);
+        }
+
+        // the first line of <name> --version, looked up once per compiler.
+        // <name> comes from getWorkerCompiler() so it is safe for a shell.
+        std::string getVersion(std::string name) {
+            std::lock_guard<std::mutex> lock(versions_mutex);
+            auto found = versions.find(name);
+            if (found != versions.end()) {
+                return found->second;
+            }
+
+            std::string output = "";
+            FILE *pipe = popen((name + " --version 2>/dev/null").c_str(), "r");
+            if (pipe != nullptr) {
+                char buffer[4096];
+                size_t n = 0;
+                while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+                    output.append(buffer, n);
+                }
+                pclose(pipe);
+            }
+            std::string version = output.substr(0, output.find('\n'));
+            versions[name] = version;
+
+            return version;
+        }
+
+        void refuse(int client, std::string reason) {
+            std::cout << "cppc worker: refused, " << reason << std::endl;
+            RemoteSocket::sendField(client, "refused");
+            RemoteSocket::sendField(client, "");
+            RemoteSocket::sendField(client, reason);
+        }
+
+        int compile(
+            std::string compiler,
+            std::vector<std::string> args,
+            std::filesystem::path dir
+        ) {
+            std::string input = (dir / "in.ii").string();
+            std::string output = (dir / "out.o").string();
+            std::string diagnostics = (dir / "diagnostics.txt").string();
+
+            std::vector<char *> argv;
+            argv.push_back(compiler.data());
+            for (auto &arg : args) {
+                argv.push_back(arg.data());
+            }
+            std::string c_flag = "-c";
+            std::string o_flag = "-o";
+            argv.push_back(c_flag.data());
+            argv.push_back(input.data());
+            argv.push_back(o_flag.data());
+            argv.push_back(output.data());
+            argv.push_back(nullptr);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                int fd = open(diagnostics.c_str(),
+                              O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd >= 0) {
+                    dup2(fd, 1);
+                    dup2(fd, 2);
+                    close(fd);
+                }
+                execvp(argv[0], argv.data());
+                // handle() refuses the job on 127 so the client compiles
+                // it locally
+                _exit(127);
+            } else if (pid < 0) {
+                return 1;
+            }
+
+            int status = 0;
+            waitpid(pid, &status, 0);
+
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+#endif
+};
+
+class RemoteClient {
+    public:
+        ///////////////////////////////////////////////////////////////////////
+        // public methods
+        ///////////////////////////////////////////////////////////////////////
+        void addWorker(std::string address) {
+            workers.push_back(std::make_unique<Worker>());
+            workers.back()->address = address;
+        }
+
+        size_t size() {
+            return workers.size();
+        }
+
+        // compiles an already preprocessed source on the least busy live
+        // worker and returns the compiler's exit status, or -1 when no
+        // worker could run it so the caller can fall back to compiling
+        // locally. <version> is the first line of the compiler's --version.
+        int compile(
+            std::string compiler,
+            std::string version,
+            std::vector<std::string> args,
+            std::string preprocessed_file,
+            std::string object_file,
+            std::string &diagnostics
+        ) {
+#ifdef _WIN32
+            return -1;
+#else
+            // jobs every worker would refuse are not sent at all
+            if (RemoteSocket::getWorkerCompiler(compiler) == "") {
+                warnOnce("Warning: " + compiler + " cannot run on remote "
+                         "workers (they run g++, clang++ or "
+                         "x86_64-w64-mingw32-g++), compiling locally");
+                return -1;
+            }
+            for (auto &arg : args) {
+                if (!RemoteSocket::isAllowedArgument(arg)) {
+                    warnOnce("Warning: remote workers do not accept " + arg
+                             + ", compiling locally");
+                    return -1;
+                }
+            }
+
+            std::string source = RemoteSocket::readFile(preprocessed_file);
+
+            for (size_t attempt = 0; attempt < workers.size(); attempt++) {
+                Worker *worker = pickWorker();
+                if (worker == nullptr) {
+                    return -1;
+                }
+
+                worker->active++;
+                std::string status;
+                std::string object;
+                bool ok = send(worker->address, compiler, version, args,
+                               source, status, object, diagnostics);
+                worker->active--;
+
+                if (ok && status == "refused") {
+                    std::cerr << "Warning: worker " << worker->address
+                              << " refused the job (" << diagnostics
+                              << "), not using it for this build" << std::endl;
+                    diagnostics = "";
+                    worker->dead = true;
+                    continue;
+                }
+                if (!ok || status == "" || status.size() > 3
+                    || status.find_first_not_of("0123456789")
+                       != std::string::npos) {
+                    std::cerr << "Warning: worker " << worker->address
+                              << " failed, not using it for this build"
+                              << std::endl;
+                    diagnostics = "";
+                    worker->dead = true;
+                    continue;
+                }
+
+                if (status == "0"
+                    && !RemoteSocket::writeFile(object_file, object)) {
+                    return -1;
+                }
+
+                return std::stoi(status);
+            }
+
+            return -1;
+#endif
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////////////////
+        // private structs
+        ///////////////////////////////////////////////////////////////////////
+        struct Worker {
+            std::string address;
+            std::atomic<int> active = 0;
+            std::atomic<bool> dead = false;
+        };
+
+        ///////////////////////////////////////////////////////////////////////
+        // private members
+        ///////////////////////////////////////////////////////////////////////
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::mutex mutex;
+        size_t next = 0;
+        std::set<std::string> warnings;
+
+        ///////////////////////////////////////////////////////////////////////
+        // private methods
+        ///////////////////////////////////////////////////////////////////////
+        void warnOnce(std::string warning) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (warnings.insert(warning).second) {
+                std::cerr << warning << std::endl;
+            }
+        }
+
+        Worker *pickWorker() {
+            std::lock_guard<std::mutex> lock(mutex);
+            Worker *best = nullptr;
+            // start after the last pick so ties rotate between workers
+            for (size_t i = 0; i < workers.size(); i++) {
+                Worker *w = workers[(next + i) % workers.size()].get();
+                if (!w->dead && (best == nullptr || w->active < best->active)) {
+                    best = w;
+                }
+            }
+            next++;
+
+            return best;
+        }
+
+#ifndef _WIN32
+        bool send(
+            std::string address,
+            std::string compiler,
+            std::string version,
+            std::vector<std::string> args,
+            std::string &source,
+            std::string &status,
+            std::string &object,
+            std::string &diagnostics
+        ) {
+            int fd = RemoteSocket::connectTo(address);
+            if (fd < 0) {
+                return false;
+            }
+
+            bool ok = RemoteSocket::sendField(fd, "CPPC2")
+                && RemoteSocket::sendField(fd, compiler)
+                && RemoteSocket::sendField(fd, version)
+                && RemoteSocket::sendField(fd, std::to_string(args.size()));
+            for (size_t i = 0; ok && i < args.size(); i++) {
+                ok = RemoteSocket::sendField(fd, args[i]);
+            }
+            ok = ok && RemoteSocket::sendField(fd, source)
+                && RemoteSocket::readField(fd, status,
+                                           RemoteSocket::max_short_field)
+                && RemoteSocket::readField(fd, object)
+                && RemoteSocket::readField(fd, diagnostics);
+            close(fd);
+
+            return ok;
+        }
+#endif
+};